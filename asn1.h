@@ -8,6 +8,7 @@
 #ifndef _ASN1_H
 #define _ASN1_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -22,7 +23,60 @@ struct ASN1_Header {
 	enum Tag_Class cls; /* Tag class */
 	uint32_t num; /* Tag number */
 	bool cons_p; /* Is encoding constructed? */
-	size_t len; /* Length of contents */
+	size_t len; /* Length of contents (0 if the length is indefinite) */
+	bool indef_p; /* Is the length indefinite?  BER only [X.690, 8.1.3.6] */
 };
 
+/* Tag numbers of universal class [ITU-T X.680, 8.4] */
+enum Universal_Tag {
+	UT_BOOLEAN = 1,
+	UT_INTEGER = 2,
+	UT_BIT_STRING = 3,
+	UT_OCTET_STRING = 4,
+	UT_NULL = 5,
+	UT_OBJECT_IDENTIFIER = 6,
+	UT_OBJECT_DESCRIPTOR = 7,
+	UT_EXTERNAL = 8,
+	UT_REAL = 9,
+	UT_ENUMERATED = 10,
+	UT_UTF8_STRING = 12,
+	UT_RELATIVE_OID = 13,
+	UT_SEQUENCE = 16,
+	UT_SET = 17,
+	UT_NUMERIC_STRING = 18,
+	UT_PRINTABLE_STRING = 19,
+	UT_TELETEX_STRING = 20,
+	UT_VIDEOTEX_STRING = 21,
+	UT_IA5_STRING = 22,
+	UT_UTC_TIME = 23,
+	UT_GENERALIZED_TIME = 24,
+	UT_GRAPHIC_STRING = 25,
+	UT_VISIBLE_STRING = 26,
+	UT_GENERAL_STRING = 27,
+	UT_UNIVERSAL_STRING = 28,
+	UT_BMP_STRING = 30
+};
+
+/* Minimal number of base-128 digits needed to represent `x' */
+static inline unsigned
+nseptets(uint32_t x)
+{
+	return x == 0 ? 1 : (32 - __builtin_clz(x) + 6) / 7;
+}
+
+/* Minimal number of octets needed to represent `x' */
+static inline unsigned
+noctets(size_t x)
+{
+	return x == 0 ? 1 : (64 - __builtin_clzll(x) + 7) / 8;
+}
+
+/* Size of DER encoding of tag header */
+static inline size_t
+header_size(const struct ASN1_Header *tag)
+{
+	return 2 + (tag->num > 30 ? nseptets(tag->num) : 0) +
+		(tag->len < 0x80 ? 0 : noctets(tag->len));
+}
+
 #endif /* _ASN1_H */
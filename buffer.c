@@ -25,6 +25,26 @@ buffer_resize(struct Buffer *buf, size_t size)
 	return 0;
 }
 
+int
+buffer_reserve(struct Buffer *buf, size_t n)
+{
+	if (buf->size >= n)
+		return 0;
+
+	const size_t len = buffer_len(buf);
+	size_t size = buf->_max_size < 64 ? 64 : buf->_max_size;
+
+	while (size - len < n)
+		size *= 2;
+
+	if (buffer_resize(buf, size) != 0)
+		return -1;
+
+	buf->wptr += len;
+	buf->size -= len;
+	return 0;
+}
+
 int
 buffer_put(struct Buffer *dest, const void *src, size_t n)
 {
@@ -34,6 +34,13 @@ static inline void INIT_BUFFER(struct Buffer *buf)
  */
 int buffer_resize(struct Buffer *buf, size_t size);
 
+/*
+ * Make room for `n' more bytes, keeping the data stored.
+ *
+ * Return -1 if memory allocation failed, otherwise return 0.
+ */
+int buffer_reserve(struct Buffer *buf, size_t n);
+
 /* Start of data region */
 static inline uint8_t * buffer_data(const struct Buffer *buf)
 {
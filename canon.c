@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canon.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "asn1.h"
+#include "util.h"
+
+/*
+ * Arena
+ *
+ * Memory of a record is allocated from chunks, which are given back
+ * all at once when the record is written (see `arena_reset').
+ */
+
+/* Minimal size of arena chunk */
+#ifdef DEBUG
+#  define CHUNK_SIZE 64
+#else
+#  define CHUNK_SIZE (64 * 1024)
+#endif
+
+struct Chunk {
+	struct Chunk *next;
+	size_t size; /* Capacity of `data' */
+	size_t used; /* Number of bytes allocated */
+	uint8_t data[];
+};
+
+static void *
+arena_alloc(struct CanonSt *z, size_t n)
+{
+	n = (n + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	struct Chunk *c = z->chunks;
+	if (c == NULL || c->size - c->used < n) {
+		struct Chunk **p = &z->spare;
+		while (*p != NULL && (*p)->size < n)
+			p = &(*p)->next;
+
+		if ((c = *p) != NULL) {
+			*p = c->next;
+		} else {
+			const size_t size = MAX(n, CHUNK_SIZE);
+			c = xmalloc(sizeof(struct Chunk) + size);
+			c->size = size;
+		}
+
+		c->used = 0;
+		c->next = z->chunks;
+		z->chunks = c;
+	}
+
+	void *rv = c->data + c->used;
+	c->used += n;
+	return rv;
+}
+
+/* Give all the memory allocated from arena back to it */
+static void
+arena_reset(struct CanonSt *z)
+{
+	while (z->chunks != NULL) {
+		struct Chunk *c = z->chunks;
+		z->chunks = c->next;
+		c->next = z->spare;
+		z->spare = c;
+	}
+}
+
+static void
+free_chunks(struct Chunk *c)
+{
+	while (c != NULL) {
+		struct Chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+}
+
+/*
+ * Tree of the record
+ */
+
+/* Node of the tree */
+struct CNode {
+	struct ASN1_Header tag; /* `len' is the length of DER contents */
+	struct CNode *parent, *child, *last, *next;
+	uint32_t nkids; /* Number of children */
+
+	uint8_t *data; /* Primitive contents */
+	size_t size; /* Size of `data' */
+
+	bool merged_p; /* Is it a constructed string to be made primitive? */
+	bool bits_p; /* Is it (a segment of) BIT STRING? */
+	uint8_t unused; /* BIT STRING: number of unused bits */
+
+	size_t enc; /* Size of DER encoding */
+	size_t start; /* Offset of the encoding in `CanonSt.out' */
+};
+
+/* Is a constructed encoding of universal type `num' a string? */
+static bool
+string_type_p(uint32_t num)
+{
+	switch (num) {
+	case UT_BIT_STRING:
+	case UT_OCTET_STRING:
+	case UT_OBJECT_DESCRIPTOR:
+	case UT_UTF8_STRING:
+	case UT_NUMERIC_STRING:
+	case UT_PRINTABLE_STRING:
+	case UT_TELETEX_STRING:
+	case UT_VIDEOTEX_STRING:
+	case UT_IA5_STRING:
+	case UT_UTC_TIME:
+	case UT_GENERALIZED_TIME:
+	case UT_GRAPHIC_STRING:
+	case UT_VISIBLE_STRING:
+	case UT_GENERAL_STRING:
+	case UT_UNIVERSAL_STRING:
+	case UT_BMP_STRING:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int
+canon_error(struct CanonSt *z, const char *msg)
+{
+	if (z->errmsg == NULL)
+		xasprintf(&z->errmsg, "%s", msg);
+	return -1;
+}
+
+/* Write DER encoding of the record to stdout; see `finish_node' */
+static int write_record(struct CanonSt *z);
+
+/*
+ * The node has been read entirely: compute the length of its DER
+ * encoding and add it to the parent.
+ */
+static int
+finish_node(struct CanonSt *z, struct CNode *node)
+{
+	struct CNode *parent = node->parent;
+
+	if (node->bits_p) {
+		if (node->merged_p) {
+			++node->tag.len; /* initial octet */
+		} else if (node->size == 0) {
+			return canon_error(z, "BIT STRING encoding has no"
+					   " initial octet\n"
+					   "  [ITU-T X.690, 8.6.2]");
+		} else {
+			node->unused = *node->data;
+		}
+
+		if (node->unused > 7 || (node->tag.len == 1 && node->unused))
+			return canon_error(z, "Invalid number of unused bits"
+					   " in BIT STRING\n"
+					   "  [ITU-T X.690, 8.6.2.2-3]");
+	}
+	node->enc = header_size(&node->tag) + node->tag.len;
+
+	if (parent == NULL)
+		return write_record(z);
+
+	if (!parent->merged_p) {
+		parent->tag.len += node->enc;
+	} else if (parent->bits_p) {
+		if (parent->unused != 0)
+			return canon_error(z, "Only the last segment of BIT"
+					   " STRING can have unused bits\n"
+					   "  [ITU-T X.690, 8.6.4]");
+		parent->unused = node->unused;
+		parent->tag.len += node->tag.len - 1;
+	} else {
+		parent->tag.len += node->tag.len;
+	}
+
+	return 0;
+}
+
+static int
+on_header(void *ctx, const struct ASN1_Header *tag, uint32_t depth)
+{
+	struct CanonSt *z = ctx;
+	struct CNode *node = arena_alloc(z, sizeof(*node));
+	struct CNode *parent = depth == 0 ? NULL : z->cur;
+
+	memset(node, 0, sizeof(*node));
+	node->tag = *tag;
+	node->tag.indef_p = false;
+	node->parent = parent;
+
+	if (parent == NULL) {
+		z->root = node;
+	} else {
+		if (parent->last == NULL)
+			parent->child = node;
+		else
+			parent->last->next = node;
+		parent->last = node;
+		++parent->nkids;
+	}
+
+	const bool universal_p = tag->cls == TC_UNIVERSAL;
+	node->bits_p = (universal_p && tag->num == UT_BIT_STRING) ||
+		(parent != NULL && parent->merged_p && parent->bits_p);
+
+	if (tag->cons_p) {
+		node->merged_p = (universal_p && string_type_p(tag->num)) ||
+			(parent != NULL && parent->merged_p);
+		node->tag.len = 0; /* to be computed */
+		z->cur = node;
+	} else {
+		/*
+		 * Contents are stored as they arrive: the length comes
+		 * from input and cannot be trusted.
+		 */
+		z->prim = node;
+		buffer_reset(&z->part);
+	}
+
+	return 0;
+}
+
+static int
+on_primitive(void *ctx, const uint8_t *data, size_t n, bool final)
+{
+	struct CanonSt *z = ctx;
+	struct CNode *node = z->prim;
+	struct Buffer *part = &z->part;
+
+	assert(node != NULL);
+	if (final && buffer_len(part) == 0) {
+		/* The contents came in one piece */
+		node->data = arena_alloc(z, n);
+		node->size = n;
+	} else {
+		if (buffer_reserve(part, n) != 0)
+			return canon_error(z, "Out of memory, buffer_reserve"
+					   " failed");
+		buffer_put(part, data, n);
+		if (!final)
+			return 0;
+
+		data = buffer_data(part);
+		n = buffer_len(part);
+		node->data = arena_alloc(z, n);
+		node->size = n;
+		buffer_reset(part);
+	}
+	if (n != 0)
+		memcpy(node->data, data, n);
+
+	assert(node->size == node->tag.len);
+	z->prim = NULL;
+	return finish_node(z, node);
+}
+
+static int
+on_end(void *ctx, uint32_t depth)
+{
+	struct CanonSt *z = ctx;
+	struct CNode *node = z->cur;
+	(void) depth;
+
+	assert(node != NULL && node->tag.cons_p);
+	z->cur = node->parent;
+	return finish_node(z, node);
+}
+
+static const struct Walk_Callbacks callbacks = {
+	on_header, on_primitive, on_end
+};
+
+/*
+ * Writing DER
+ */
+
+/* Element of SET being sorted */
+struct Elem {
+	const struct CNode *node;
+	const uint8_t *enc; /* DER encoding */
+};
+
+/* Canonical order of tags [ITU-T X.680, 8.6] */
+static int
+cmp_tags(const void *a, const void *b)
+{
+	const struct ASN1_Header *x = &((const struct Elem *) a)->node->tag;
+	const struct ASN1_Header *y = &((const struct Elem *) b)->node->tag;
+
+	if (x->cls != y->cls)
+		return x->cls < y->cls ? -1 : 1;
+	return x->num < y->num ? -1 : x->num > y->num;
+}
+
+/*
+ * Order of encodings: the shorter one is compared as if padded with
+ * trailing zero octets [ITU-T X.690, 11.6].
+ */
+static int
+cmp_encodings(const void *a, const void *b)
+{
+	const struct Elem *x = a;
+	const struct Elem *y = b;
+	const size_t n = MIN(x->node->enc, y->node->enc);
+
+	const int r = memcmp(x->enc, y->enc, n);
+	if (r != 0 || x->node->enc == y->node->enc)
+		return r;
+
+	const struct Elem *longer = x->node->enc > n ? x : y;
+	size_t i;
+	for (i = n; i < longer->node->enc; ++i) {
+		if (longer->enc[i] != 0)
+			return longer == x ? 1 : -1;
+	}
+	return 0;
+}
+
+/*
+ * Sort the encodings of SET elements, which have just been written.
+ * Elements with distinct tags are ordered by tag [ITU-T X.690, 10.3],
+ * otherwise (SET OF) by encoding [ITU-T X.690, 11.6].
+ */
+static void
+sort_set(struct CanonSt *z, const struct CNode *set)
+{
+	uint8_t *start = buffer_data(&z->out) + set->child->start;
+	struct Elem *elems = arena_alloc(z, set->nkids * sizeof(*elems));
+	const struct CNode *c;
+	uint32_t i, n = 0;
+
+	for (c = set->child; c != NULL; c = c->next, ++n) {
+		elems[n].node = c;
+		elems[n].enc = buffer_data(&z->out) + c->start;
+	}
+
+	qsort(elems, n, sizeof(*elems), cmp_tags);
+	for (i = 1; i < n && cmp_tags(elems + i - 1, elems + i) != 0; ++i)
+		;
+	if (i < n)
+		qsort(elems, n, sizeof(*elems), cmp_encodings);
+
+	uint8_t *tmp = arena_alloc(z, set->tag.len);
+	uint8_t *p = tmp;
+	for (i = 0; i < n; p += elems[i++].node->enc)
+		memcpy(p, elems[i].enc, elems[i].node->enc);
+
+	memcpy(start, tmp, set->tag.len);
+}
+
+/* Clear unused bits of BIT STRING [ITU-T X.690, 11.2.1] */
+static inline void
+clear_unused(struct CanonSt *z, uint8_t unused)
+{
+	z->out.wptr[-1] &= 0xff << unused;
+}
+
+/* Write the header and primitive contents of the node */
+static void
+begin_node(struct CanonSt *z, struct CNode *node, struct Stream *str)
+{
+	const bool segment_p = node->parent != NULL &&
+		node->parent->merged_p;
+	struct Buffer *out = &z->out;
+
+	node->start = buffer_len(out);
+
+	if (!segment_p) {
+		struct ASN1_Header h = node->tag;
+		h.cons_p = h.cons_p && !node->merged_p;
+
+		encode_der_header(&h, out, str);
+		if (node->merged_p && node->bits_p)
+			buffer_putc(out, node->unused);
+	}
+
+	if (node->tag.cons_p)
+		return;
+
+	const uint8_t *data = node->data;
+	size_t n = node->size;
+
+	if (segment_p && node->bits_p) {
+		++data; /* initial octet */
+		--n;
+	}
+
+	if (!segment_p && node->tag.cls == TC_UNIVERSAL &&
+	    node->tag.num == UT_BOOLEAN && n == 1) {
+		buffer_putc(out, *data == 0 ? 0 : 0xff);
+		return;
+	}
+
+	buffer_put(out, data, n);
+	if (!segment_p && node->bits_p && n > 1)
+		clear_unused(z, node->unused);
+}
+
+/* Finish the encoding of constructed node, once its children are written */
+static void
+end_node(struct CanonSt *z, struct CNode *node)
+{
+	if (!node->tag.cons_p)
+		return;
+
+	if (node->merged_p) {
+		const bool segment_p = node->parent != NULL &&
+			node->parent->merged_p;
+		if (!segment_p && node->bits_p && node->tag.len > 1)
+			clear_unused(z, node->unused);
+	} else if (node->tag.cls == TC_UNIVERSAL && node->tag.num == UT_SET &&
+		   node->nkids > 1) {
+		sort_set(z, node);
+	}
+}
+
+/* Discard the tree of the record */
+static void
+drop_tree(struct CanonSt *z)
+{
+	arena_reset(z);
+	z->root = z->cur = z->prim = NULL;
+	buffer_reset(&z->part);
+}
+
+static int
+write_record(struct CanonSt *z)
+{
+	struct Stream str = STREAM_INIT;
+
+	buffer_reset(&z->out);
+	if (buffer_reserve(&z->out, z->root->enc) != 0)
+		die("Out of memory, buffer_reserve failed");
+
+	/* Walk the tree in pre-order, with no recursion */
+	struct CNode *node = z->root;
+	while (node != NULL) {
+		begin_node(z, node, &str);
+		if (node->child != NULL) {
+			node = node->child;
+			continue;
+		}
+
+		for (;;) {
+			end_node(z, node);
+			if (node->next != NULL) {
+				node = node->next;
+				break;
+			}
+			if ((node = node->parent) == NULL)
+				break;
+		}
+	}
+
+	assert(str.errmsg == NULL && buffer_len(&z->out) == z->root->enc);
+	fwrite(buffer_data(&z->out), buffer_len(&z->out), 1, stdout);
+
+	drop_tree(z);
+	return 0;
+}
+
+void
+init_CanonSt(struct CanonSt *z, const struct Repr_Format *repr,
+	     unsigned flags)
+{
+	z->dec = xmalloc(sizeof(struct DecSt));
+	init_DecSt(z->dec, repr, flags);
+	z->dec->cb = &callbacks;
+	z->dec->cb_ctx = z;
+
+	z->chunks = z->spare = NULL;
+	z->root = z->cur = z->prim = NULL;
+	INIT_BUFFER(&z->part);
+	INIT_BUFFER(&z->out);
+	z->errmsg = NULL;
+}
+
+void
+reset_CanonSt(struct CanonSt *z)
+{
+	reset_DecSt(z->dec);
+	drop_tree(z);
+
+	free(z->errmsg);
+	z->errmsg = NULL;
+}
+
+void
+free_CanonSt(struct CanonSt *z)
+{
+	if (z == NULL)
+		return;
+
+	free_DecSt(z->dec);
+	free_chunks(z->chunks);
+	free_chunks(z->spare);
+	free(buffer_data(&z->part));
+	free(buffer_data(&z->out));
+	free(z->errmsg);
+	free(z);
+}
+
+int
+recover_CanonSt(struct CanonSt *z)
+{
+	drop_tree(z);
+	return recover_DecSt(z->dec);
+}
+
+size_t
+skipped_CanonSt(struct CanonSt *z)
+{
+	return skipped_DecSt(z->dec);
+}
+
+IterV
+canonicalize(struct CanonSt *z, struct Stream *str)
+{
+	const IterV indic = walk(z->dec, str);
+
+	if (z->errmsg != NULL) {
+		/* Replace "Stopped by ... handler" message */
+		free_errmsg(str->errmsg);
+		str->errmsg = z->errmsg;
+		z->errmsg = NULL;
+	}
+
+	return indic;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _CANON_H
+#define _CANON_H
+
+/*
+ * Canonicalizer -- converts BER data to DER [ITU-T X.690, 10, 11]:
+ *
+ *   - lengths are definite and encoded in the minimum number of octets;
+ *   - constructed encodings of universal string types are merged into
+ *     primitive ones;
+ *   - elements of SET are sorted (by tag if the tags are distinct,
+ *     otherwise by encoding, as in SET OF);
+ *   - BOOLEAN TRUE is 0xff, unused bits of BIT STRING are zero.
+ *
+ * Input is parsed by `walk' (see decoder.h).  Each top-level record is
+ * kept in memory till its end, then written to stdout.  Memory is drawn
+ * from an arena that is reused for subsequent records, so it is bounded
+ * by the size of the largest record.  Contents of primitive encodings
+ * are stored as they are read, not as their declared lengths suggest.
+ *
+ * Strings of implicitly tagged types cannot be recognized without
+ * the specification and are left as they are.
+ */
+
+#include "iteratee.h"
+#include "buffer.h"
+
+struct DecSt;
+struct Repr_Format;
+struct Chunk;
+struct CNode;
+
+/* State of canonicalizer */
+struct CanonSt {
+	struct DecSt *dec; /* Parser of input */
+
+	struct Chunk *chunks; /* Arena memory in use, the latest chunk first */
+	struct Chunk *spare; /* Arena memory kept for reuse */
+	struct CNode *root; /* Tree of the record being read (or NULL) */
+	struct CNode *cur; /* Innermost constructed node being read */
+	struct CNode *prim; /* Primitive node being read (or NULL) */
+	struct Buffer part; /* Contents of `prim' read so far */
+
+	struct Buffer out; /* DER encoding of the record */
+	char *errmsg; /* Error to report instead of the handler's one */
+};
+
+void init_CanonSt(struct CanonSt *z, const struct Repr_Format *repr,
+		  unsigned flags);
+
+/*
+ * Prepare canonicalizer for processing another input from scratch.
+ * Allocated memory is kept for reuse.
+ */
+void reset_CanonSt(struct CanonSt *z);
+
+void free_CanonSt(struct CanonSt *z);
+
+/* Abandon the record being read; see `recover_DecSt' */
+int recover_CanonSt(struct CanonSt *z);
+
+/* See `skipped_DecSt' */
+size_t skipped_CanonSt(struct CanonSt *z);
+
+/* Convert BER data to DER, writing top-level records to stdout */
+IterV canonicalize(struct CanonSt *z, struct Stream *str);
+
+#endif /* _CANON_H */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cat.h"
+#include "records.h"
+#include "util.h"
+
+/* Write `n' filler bytes */
+static int
+pad(struct Cat *c, off_t n)
+{
+	static uint8_t fillers[4096];
+	if (fillers[0] != 0xff)
+		memset(fillers, 0xff, sizeof(fillers));
+
+	while (n > 0) {
+		const ssize_t k = write(c->fd, fillers,
+					MIN(n, (off_t) sizeof(fillers)));
+		if (k < 0 && errno == EINTR)
+			continue;
+		if (k < 0) {
+			error(0, errno, "write error");
+			return -1;
+		}
+		n -= k;
+	}
+
+	c->used = 0;
+	return 0;
+}
+
+/* Copy bytes [start, end) of the file; they are not padded */
+static int
+flush(struct Cat *c, struct Records *r, off_t start, off_t end,
+      const char *inpath)
+{
+	if (end == start)
+		return 0;
+
+	if (copy_range(c->fd, r->fd, start, end - start) != 0) {
+		error(0, errno, "%s: copying failed", inpath);
+		return -1;
+	}
+
+	if (c->blksize != 0)
+		c->used = (c->used + end - start) % c->blksize;
+	return 0;
+}
+
+int
+cat_file(struct Cat *c, const char *inpath)
+{
+	struct Records r;
+	if (records_open(&r, inpath) != 0)
+		return -1;
+
+	/*
+	 * Adjacent records are copied in one go; `[start, end)' is
+	 * the range of records not copied yet.
+	 */
+	off_t start = 0, end = 0;
+	struct Record rec;
+	int found;
+	int retval = 0;
+
+	while ((found = next_record(&r, &rec)) > 0) {
+		const off_t size = record_size(&rec);
+
+		/* Occupancy of current block, once the range is copied */
+		const off_t occ = c->blksize == 0 ? 0 :
+			(c->used + end - start) % c->blksize;
+		/* Should the record start another block? */
+		const bool pad_p = occ != 0 && occ + size > c->blksize;
+
+		if (r.nfill != 0 || pad_p) {
+			if (flush(c, &r, start, end, inpath) != 0 ||
+			    (pad_p && pad(c, c->blksize - occ) != 0)) {
+				retval = -1;
+				break;
+			}
+			start = rec.offset;
+		}
+
+		end = record_end(&rec);
+	}
+
+	if (found < 0) {
+		error_at_line(0, 0, inpath, r.pos, "%s", r.errmsg);
+		retval = -1;
+	}
+
+	/* Records that precede an error are copied nevertheless */
+	if (found <= 0 && flush(c, &r, start, end, inpath) != 0)
+		retval = -1;
+
+	records_close(&r);
+	return retval;
+}
+
+int
+cat_finish(struct Cat *c)
+{
+	return c->used == 0 ? 0 : pad(c, c->blksize - c->used);
+}
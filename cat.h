@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _CAT_H
+#define _CAT_H
+
+/*
+ * Concatenation of DER files
+ *
+ * Top-level records of the files are copied to the output, filler
+ * bytes between them are dropped.  Optionally the records are packed
+ * into blocks of fixed size, the rest of each block being filled with
+ * fillers, as legacy consumers expect.
+ */
+
+#include <sys/types.h>
+
+struct Cat {
+	int fd; /* Output file */
+	off_t blksize; /* Size of block; 0 -- do not pad */
+	off_t used; /* Number of bytes written to current block */
+};
+
+#define CAT_INIT(fd, blksize) { fd, blksize, 0 }
+
+/*
+ * Append the records of a file to the output.
+ *
+ * Return value: 0 - success, -1 - error.
+ */
+int cat_file(struct Cat *c, const char *inpath);
+
+/*
+ * Pad the last block (if necessary).
+ *
+ * Return value: 0 - success, -1 - error.
+ */
+int cat_finish(struct Cat *c);
+
+#endif /* _CAT_H */
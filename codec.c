@@ -10,36 +10,94 @@
 #include "codec.h"
 #include "decoder.h"
 #include "encoder.h"
+#include "canon.h"
 #include "util.h"
 
 IterV
-run_codec(enum Codec_T type, void **z, struct Stream *str,
+run_codec(enum Codec_T type, unsigned flags, void **z, struct Stream *str,
 	  const struct Repr_Format *repr)
 {
-	if (type == DECODER) {
+	if (type == DECODER || type == CHECKER) {
 		if (*z == NULL) {
 			*z = xmalloc(sizeof(struct DecSt));
-			init_DecSt(*z, repr);
+			init_DecSt(*z, repr, flags);
 		}
-		return decode(*z, str);
+		return type == DECODER ? decode(*z, str) : walk(*z, str);
 	} else if (type == ENCODER) {
 		if (*z == NULL) {
 			*z = xmalloc(sizeof(struct EncSt));
-			init_EncSt(*z);
+			init_EncSt(*z, repr, flags);
 		}
 		return encode(*z, str);
+	} else if (type == CANONICALIZER) {
+		if (*z == NULL) {
+			*z = xmalloc(sizeof(struct CanonSt));
+			init_CanonSt(*z, repr, flags);
+		}
+		return canonicalize(*z, str);
 	} else {
 		assert(0 == 1);
 	}
 }
 
+void
+reset_codec(enum Codec_T type, void *z)
+{
+	if (z == NULL)
+		return;
+
+	if (type == DECODER || type == CHECKER)
+		reset_DecSt(z);
+	else if (type == ENCODER)
+		reset_EncSt(z);
+	else if (type == CANONICALIZER)
+		reset_CanonSt(z);
+	else
+		assert(0 == 1);
+}
+
 void
 free_codec(enum Codec_T type, void *z)
 {
-	if (type == DECODER)
+	if (type == DECODER || type == CHECKER)
 		free_DecSt(z);
 	else if (type == ENCODER)
 		free_EncSt(z);
+	else if (type == CANONICALIZER)
+		free_CanonSt(z);
 	else
 		assert(0 == 1);
 }
+
+int
+recover_codec(enum Codec_T type, void *z)
+{
+	if (type == DECODER || type == CHECKER)
+		return recover_DecSt(z);
+	else if (type == CANONICALIZER)
+		return recover_CanonSt(z);
+	else
+		return -1;
+}
+
+size_t
+skipped_codec(enum Codec_T type, void *z)
+{
+	if (type == DECODER || type == CHECKER)
+		return skipped_DecSt(z);
+	else if (type == CANONICALIZER)
+		return skipped_CanonSt(z);
+	else
+		return 0;
+}
+
+int
+locate_codec(enum Codec_T type, const void *z, unsigned long *line,
+	     unsigned long *col)
+{
+	if (type != ENCODER || z == NULL)
+		return -1;
+
+	locate_EncSt(z, line, col);
+	return 0;
+}
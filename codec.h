@@ -13,13 +13,65 @@
 struct Repr_Format;
 
 /* Type of codec */
-enum Codec_T { DECODER, ENCODER };
+enum Codec_T {
+	DECODER,
+	ENCODER,
+	CHECKER, /* DER validator; see `walk' in decoder.h */
+	CANONICALIZER /* BER to DER converter; see canon.h */
+};
+
+/* Codec options (bit flags) */
+enum Codec_Flag {
+	/* Try to recover from errors (see `recover_codec') */
+	CF_KEEP_GOING = 1 << 0,
+
+	/* Reject BER encodings that are not valid DER [ITU-T X.690, 10] */
+	CF_STRICT = 1 << 1,
+
+	/* Layout of decoder's output (the default is a tag per line) */
+	CF_LINE = 1 << 2, /* a record per line */
+	CF_HANG = 1 << 3, /* indentation only, no parentheses */
+
+	/* Decode primitive universal tags to typed representations */
+	CF_TYPED = 1 << 4,
+
+	/* Write encoded records as PEM blocks (see pem.h) */
+	CF_PEM = 1 << 5
+};
 
 /* XXX */
-IterV run_codec(enum Codec_T type, void **z, struct Stream *str,
-		const struct Repr_Format *repr);
+IterV run_codec(enum Codec_T type, unsigned flags, void **z,
+		struct Stream *str, const struct Repr_Format *repr);
+
+/*
+ * Prepare codec's state (z) for processing another input, keeping
+ * allocated memory for reuse.
+ */
+void reset_codec(enum Codec_T type, void *z);
 
 /* Release resources allocated for codec's state (z) */
 void free_codec(enum Codec_T type, void *z);
 
+/*
+ * Prepare codec for processing the rest of input after an error.
+ *
+ * Return -1 if the codec is unable to continue, otherwise return 0.
+ */
+int recover_codec(enum Codec_T type, void *z);
+
+/*
+ * Return the number of input bytes skipped by codec while recovering
+ * from an error, once it resumes processing; otherwise return 0.
+ */
+size_t skipped_codec(enum Codec_T type, void *z);
+
+/*
+ * Get the location of the latest error as line number and column.
+ *
+ * Return -1 if the codec does not track lines (the error is located by
+ * byte offset then), otherwise return 0.
+ */
+int locate_codec(enum Codec_T type, const void *z, unsigned long *line,
+		 unsigned long *col);
+
 #endif /* _CODEC_H */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include "libunder.h"
+#include "decoder.h"
+#include "util.h"
+
+void
+under_cursor_init(struct Under_Cursor *c, const void *buf, size_t n)
+{
+	c->value = NULL;
+	c->next = buf;
+	c->end = c->next + n;
+	c->depth = 0;
+	c->errmsg = NULL;
+}
+
+int
+under_next(struct Under_Cursor *c)
+{
+#ifdef FILLERS
+	if (c->depth == 0) /* skip fillers */
+		c->next += filler_span(c->next, c->end - c->next);
+#endif
+
+	if (c->next == c->end) {
+		c->value = NULL;
+		return 0;
+	}
+
+	const size_t avail = c->end - c->next;
+	struct ASN1_Header tag;
+	const int hsize = parse_header(&tag, c->next, avail);
+
+	if (hsize <= 0) {
+		c->errmsg = hsize == 0 ? "Unexpected end of data" :
+			"Invalid tag header";
+		return -1;
+	} else if (tag.len > avail - hsize) {
+		c->errmsg = "Tag is too big for its container";
+		return -1;
+	}
+
+	export_header(&c->tag, &tag);
+
+	c->value = c->next + hsize;
+	c->next = c->value + c->tag.len;
+	return 1;
+}
+
+int
+under_enter(struct Under_Cursor *c)
+{
+	if (c->value == NULL || !c->tag.cons_p ||
+	    c->depth == UNDER_MAX_DEPTH)
+		return -1;
+
+	c->ends[c->depth++] = c->end;
+	c->end = c->next;
+	c->next = c->value;
+	c->value = NULL;
+	return 0;
+}
+
+int
+under_skip(struct Under_Cursor *c)
+{
+	if (c->depth == 0)
+		return -1;
+
+	c->next = c->end;
+	c->end = c->ends[--c->depth];
+	c->value = NULL;
+	return 0;
+}
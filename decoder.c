@@ -10,65 +10,50 @@
 #include <stdarg.h>
 
 #include "decoder.h"
+#include "codec.h"
 #include "buffer.h"
 #include "asn1.h"
 #include "util.h"
 #include "repr.h"
-
-void
-free_DecSt(struct DecSt *z)
-{
-	if (z == NULL)
-		return;
-
-	if (z->buf_repr != NULL) {
-		free(buffer_data(z->buf_repr));
-		free(z->buf_repr);
-	}
-
-	if (z->buf_raw != NULL) {
-		free(buffer_data(z->buf_raw));
-		free(z->buf_raw);
-	}
-
-	free(z);
-}
+#include "universal.h"
 
 #ifdef FILLERS
-static inline bool
-isfiller(uint8_t c)
+/* Skip filler bytes; see `drop_while' */
+static inline IterV
+drop_fillers(struct Stream *str)
 {
-	return c == 0xff;
+	const size_t n = filler_span(str->data, str->size);
+
+	str->data += n;
+	str->size -= n;
+	return str->size == 0 ? IE_CONT : IE_DONE;
 }
 #endif
 
 /*
  * Parse tag identifier and length octets and store decoded attributes
- * in a `*tag'.
+ * in `z->tag'.
  */
 static IterV
-#ifdef FILLERS
-decode_header(struct ASN1_Header *tag, struct Stream *str, bool at_root_p)
-#else
-decode_header(struct ASN1_Header *tag, struct Stream *str)
-#endif
+decode_header(struct DecSt *z, struct Stream *str)
 {
-	static int cont = 0; /* Position to continue execution from */
-	static size_t len_sz; /* Number of length octets, excluding initial */
+	struct ASN1_Header *tag = &z->tag;
+	int *cont = &z->hdr_cont; /* Position to continue execution from */
+	size_t *len_sz = &z->len_sz; /* Number of length octets left */
 
 	uint8_t c;
 
-	switch (cont) {
+	switch (*cont) {
 	case 0:
-		debug_print("decode_header, cont=%d", cont);
+		debug_print("decode_header, cont=%d", *cont);
 #ifdef FILLERS
-		if (at_root_p && drop_while(isfiller, str) == IE_CONT)
+		if (z->depth == 0 && drop_fillers(str) == IE_CONT)
 			return IE_CONT;
 #endif
 
-		++cont;
+		++*cont;
 	case 1: /* Identifier octet(s) -- cases 1, 2 */
-		debug_print("decode_header, cont=%d", cont);
+		debug_print("decode_header, cont=%d", *cont);
 
 		if (str->type == S_EOF)
 			return IE_DONE;
@@ -78,36 +63,48 @@ decode_header(struct ASN1_Header *tag, struct Stream *str)
 
 		tag->cls = (c & 0xc0) >> 6;
 		tag->cons_p = (c & 0x20) != 0;
+		tag->indef_p = false;
 		debug_print(" \\_ tag_cls = '%c', %s",
 			    "uacp"[tag->cls], tag->cons_p ? "cons" : "prim");
 
-		if ((tag->num = c & 0x1f) == 0x1f)
+		if ((tag->num = c & 0x1f) == 0x1f) {
 			tag->num = 0; /* tag number > 30 */
-		else
+			z->nocts = 0;
+		} else {
 			goto tagnum_done;
+		}
 
-		++cont;
+		++*cont;
 	case 2: /* Tag number > 30 (``high'' tag number) */
-		debug_print("decode_header, cont=%d", cont);
+		debug_print("decode_header, cont=%d", *cont);
 
 		for (; str->size > 0 && *str->data & 0x80;
-		     ++str->data, --str->size)
+		     ++str->data, --str->size, ++z->nocts)
 			tag->num = (tag->num << 7) | (*str->data & 0x7f);
 
 		if (head(&c, str) == IE_CONT)
 			return IE_CONT;
 		tag->num = (tag->num << 7) | (c & 0x7f);
 
-tagnum_done:
 		if (tag->num & 0xc0000000) { /* exceeds 30 bits */
 			set_error(str, "Tag number is too big: %u", tag->num);
 			return IE_CONT;
 		}
+
+		if (z->flags & CF_STRICT &&
+		    (tag->num <= 30 || ++z->nocts != nseptets(tag->num))) {
+			set_error(str, "Tag number is not encoded in the"
+				  " minimum number of octets\n"
+				  "  [ITU-T X.690, 8.1.2.2, 8.1.2.4.2-c]");
+			return IE_CONT;
+		}
+
+tagnum_done:
 		debug_print(" \\_ tag_num = %u", tag->num);
 
-		++cont;
+		*cont = 3; /* `goto tagnum_done' jumps over case 2 */
 	case 3: /* Initial length octet */
-		debug_print("decode_header, cont=%d", cont);
+		debug_print("decode_header, cont=%d", *cont);
 
 		if (head(&c, str) == IE_CONT)
 			return IE_CONT;
@@ -118,17 +115,36 @@ tagnum_done:
 			return IE_CONT;
 		}
 
+		if (c == 0x80) { /* indefinite form */
+			if (z->flags & CF_STRICT) {
+				set_error(str, "Indefinite length form is not"
+					  " allowed\n  [ITU-T X.690, 10.1]");
+				return IE_CONT;
+			} else if (!tag->cons_p) {
+				set_error(str, "Primitive encoding cannot have"
+					  " indefinite length\n"
+					  "  [ITU-T X.690, 8.1.3.2-a]");
+				return IE_CONT;
+			}
+
+			debug_print(" \\_ tag_len = indefinite");
+			tag->indef_p = true;
+			tag->len = 0;
+			break;
+		}
+
 		if (c & 0x80) { /* long form */
-			len_sz = c & 0x7f;
-			if (len_sz > 8) {
+			*len_sz = c & 0x7f;
+			if (*len_sz > 8) {
 				set_error(str, "Too many octets as for length"
 					  " encoding: %lu",
-					  (unsigned long) len_sz);
+					  (unsigned long) *len_sz);
 				return IE_CONT;
 			}
 
 			debug_print(" \\_ len_sz = %lu",
-				    (unsigned long) len_sz);
+				    (unsigned long) *len_sz);
+			z->nocts = *len_sz;
 			tag->len = 0;
 		} else { /* short form*/
 			tag->len = c;
@@ -137,24 +153,31 @@ tagnum_done:
 			break;
 		}
 
-		++cont;
+		++*cont;
 	case 4: /* Subsequent length octet(s) */
-		debug_print("decode_header, cont=%d", cont);
+		debug_print("decode_header, cont=%d", *cont);
 
-		for (; str->size > 0 && len_sz > 0;
-		     --len_sz, ++str->data, --str->size)
+		for (; str->size > 0 && *len_sz > 0;
+		     --*len_sz, ++str->data, --str->size)
 			tag->len = (tag->len << 8) | *str->data;
 
-		if (len_sz > 0)
+		if (*len_sz > 0)
 			return IE_CONT;
 		debug_print(" \\_ tag_len = %lu", (unsigned long) tag->len);
 
+		if (z->flags & CF_STRICT &&
+		    (tag->len < 0x80 || z->nocts != noctets(tag->len))) {
+			set_error(str, "Length is not encoded in the minimum"
+				  " number of octets\n  [ITU-T X.690, 10.1]");
+			return IE_CONT;
+		}
+
 		break;
 	default:
 		assert(0 == 1);
 	}
 
-	cont = 0;
+	*cont = 0;
 	return IE_DONE;
 }
 
@@ -162,20 +185,19 @@ tagnum_done:
  * Print hexadecimal dump of stream contents.
  *
  * @final: Does `*str' contain all the bytes that need to be hexdumped?
+ * @cont: position to continue from
  */
 static IterV
-print_hexdump(struct Stream *str, bool final)
+print_hexdump(struct Stream *str, bool final, int *cont)
 {
-	static int cont = 0;
-
-	switch (cont) {
+	switch (*cont) {
 	case 0:
-		debug_print("print_hexdump, cont=%d", cont);
+		debug_print("print_hexdump, cont=%d", *cont);
 		putchar('"');
 
-		++cont;
+		++*cont;
 	case 1:
-		debug_print("print_hexdump, cont=%d", cont);
+		debug_print("print_hexdump, cont=%d", *cont);
 		{
 			uint8_t c;
 			if (head(&c, str) == IE_CONT) {
@@ -186,9 +208,9 @@ print_hexdump(struct Stream *str, bool final)
 			printf("%02x", c);
 		}
 
-		++cont;
+		++*cont;
 	case 2:
-		debug_print("print_hexdump, cont=%d", cont);
+		debug_print("print_hexdump, cont=%d", *cont);
 
 		for (; str->size > 0; ++str->data, --str->size)
 			printf(" %02x", *str->data);
@@ -202,7 +224,7 @@ print_hexdump(struct Stream *str, bool final)
 	}
 
 	putchar('"');
-	cont = 0;
+	*cont = 0;
 	return IE_DONE;
 }
 
@@ -270,14 +292,14 @@ print_prim(struct Stream *str, bool enough, Repr_Codec _decode, struct DecSt *z)
 	assert(str->type == S_CHUNK);
 
 	if (_decode == NULL)
-		return print_hexdump(str, enough);
+		return print_hexdump(str, enough, &z->hexdump_cont);
 	else if (z->buf_repr == NULL)
 		z->buf_repr = new_buffer(128);
 
-	static int cont = 0;
-	debug_print("print_prim: cont=%d", cont);
+	int *cont = &z->prim_cont;
+	debug_print("print_prim: cont=%d", *cont);
 
-	switch (cont) {
+	switch (*cont) {
 	case 0:
 		if (enough) {
 			if (call(_decode, z->buf_repr, str->data, str->size)
@@ -295,10 +317,14 @@ print_prim(struct Stream *str, bool enough, Repr_Codec _decode, struct DecSt *z)
 		if (z->buf_raw == NULL)
 			z->buf_raw = new_buffer(64);
 
-		++cont;
+		++*cont;
 	case 1:
-		if (store(z->buf_raw, str->data, str->size, str) != 0)
+		buffer_reserve(z->buf_raw, str->size);
+		if (store(z->buf_raw, str->data, str->size, str) != 0) {
+			buffer_reset(z->buf_raw);
+			*cont = 0;
 			return IE_CONT;
+		}
 
 		if (!enough) {
 			str->data += str->size;
@@ -332,14 +358,22 @@ print_prim(struct Stream *str, bool enough, Repr_Codec _decode, struct DecSt *z)
 	if (z->buf_raw != NULL)
 		buffer_reset(z->buf_raw);
 
-	cont = 0;
+	*cont = 0;
 	return IE_DONE;
 }
 
-/* Type of elements of `DecSt.caps' list */
+/*
+ * Type of elements of `DecSt.caps' list.
+ *
+ * A container of indefinite length starts with the capacity of its
+ * parent (or SIZE_MAX at the top level) and is closed by end-of-contents
+ * octets rather than by draining off.
+ */
 struct Capacity {
 	struct list_head h;
 	size_t value;
+	const struct Repr *repr; /* Representation of the container */
+	bool indef_p; /* Is the length of container indefinite? */
 };
 
 static inline size_t
@@ -370,16 +404,80 @@ contained_p(size_t n, const struct DecSt *z)
 	return z->depth == 0 /* infinite capacity */ || remcap(z) >= n;
 }
 
-static void
-add_capacity(size_t n, struct DecSt *dest)
+/*
+ * Enter a container of capacity `n'.
+ *
+ * Return -1 if memory allocation failed (the error is set in `str'),
+ * otherwise return 0.
+ */
+static int
+add_capacity(size_t n, struct DecSt *dest, struct Stream *str)
 {
 	debug_print("add_capacity %lu", (unsigned long) n);
 
-	struct Capacity *new = xmalloc(sizeof(struct Capacity));
+	struct Capacity *new;
+	if (list_empty(&dest->spare_caps)) {
+		if ((new = malloc(sizeof(struct Capacity))) == NULL) {
+			set_error(str, "Out of memory, malloc failed");
+			return -1;
+		}
+	} else {
+		new = list_first_entry(&dest->spare_caps, struct Capacity, h);
+		__list_del(new->h.prev, new->h.next);
+	}
 	new->value = n;
+	new->repr = dest->tag_repr;
+	new->indef_p = false;
 
 	list_add(&new->h, &dest->caps);
 	++dest->depth;
+	return 0;
+}
+
+/* Enter a container of indefinite length */
+static int
+add_indefinite(struct DecSt *z, struct Stream *str)
+{
+	if (add_capacity(z->depth == 0 ? SIZE_MAX : remcap(z), z, str) != 0)
+		return -1;
+	list_first_entry(&z->caps, struct Capacity, h)->indef_p = true;
+	return 0;
+}
+
+/* Is the innermost container of indefinite length? */
+static inline bool
+indefinite_p(const struct DecSt *z)
+{
+	return z->depth != 0 &&
+		list_first_entry(&z->caps, struct Capacity, h)->indef_p;
+}
+
+/* Is the latest header the end-of-contents octets [X.690, 8.1.5]? */
+static inline bool
+eoc_p(const struct DecSt *z)
+{
+	return z->tag.cls == TC_UNIVERSAL && z->tag.num == 0 &&
+		!z->tag.cons_p && z->tag.len == 0 && indefinite_p(z);
+}
+
+/* Leave the innermost container, which is of indefinite length */
+static void
+drop_indefinite(struct DecSt *z)
+{
+	assert(indefinite_p(z));
+	list_move(z->caps.next, &z->spare_caps);
+	--z->depth;
+}
+
+/* Report an attempt to read past the end of the innermost container */
+static void
+beyond_container(const struct DecSt *z, struct Stream *master)
+{
+	if (indefinite_p(z))
+		set_error(master, "End-of-contents octets are missing\n"
+			  "  [ITU-T X.690, 8.1.3.6]");
+	else
+		set_error(master, "Trying to go beyond the end of container");
 }
 
 static inline void
@@ -411,27 +509,142 @@ check_DecSt_invariant(const struct DecSt *z)
 
 /*
  * Remove "drained off" capacities from `z->caps' list, freeing their
- * memory. Decrease `z->depth' by the number of deleted elements and
- * print that many closing parentheses.
+ * memory. Decrease `z->depth' by the number of deleted elements.
+ *
+ * Return the number of deleted elements.
  */
-static void
-close_drained_containers(struct DecSt *z)
+static uint32_t
+drop_drained_capacities(struct DecSt *z)
 {
 	struct list_head *p, *t;
+	uint32_t n = 0;
 
 	list_for_each_safe(p, t, &z->caps) {
-		if (capacity(p) != 0)
+		if (capacity(p) != 0 ||
+		    list_entry(p, struct Capacity, h)->indef_p)
 			break;
 
-		__list_del(p->prev, p->next);
-		free(list_entry(p, struct Capacity, h));
+		list_move(p, &z->spare_caps);
 		debug_print("zero capacity deleted");
 
 		--z->depth;
-		putchar(')');
+		++n;
 	}
 
 	check_DecSt_invariant(z);
+	return n;
+}
+
+/*
+ * Output layouts
+ *
+ * Layout-specific parts of decoder's output are produced by the
+ * `emit_*' functions.  `decode_chunk' is instantiated once per layout
+ * with a constant `layout' argument, so the tests below are folded at
+ * compile time.
+ */
+
+/* Output layouts (see `enum Codec_Flag') */
+enum Layout {
+	LAYOUT_DEFAULT, /* a tag per line, nested tags are indented */
+	LAYOUT_LINE, /* a record per line */
+	LAYOUT_HANG /* indentation only, no parentheses */
+};
+
+/* Start of tag */
+static inline void
+emit_open(enum Layout layout)
+{
+	if (layout != LAYOUT_HANG)
+		putchar('(');
+}
+
+/* Contents of zero length */
+static inline void
+emit_empty(bool cons_p, enum Layout layout)
+{
+	if (layout == LAYOUT_HANG)
+		fputs(cons_p ? ":" : " \"\"", stdout);
+	else
+		fputs(cons_p ? " ()" : " \"\"", stdout);
+}
+
+/* Start of constructed contents */
+static inline void
+emit_cons(enum Layout layout)
+{
+	if (layout == LAYOUT_HANG)
+		putchar(':');
+}
+
+/*
+ * Runs of closing parentheses and indentations are written with
+ * a single fwrite(3) from these strings (several, for very deep trees).
+ */
+#define _S16 "                "
+#define _P16 "))))))))))))))))"
+static const char close_run[] = _P16 _P16;
+static const char indent_run[] = "\n" _S16 _S16 _S16 _S16 _S16 _S16 _S16 _S16;
+#undef _P16
+#undef _S16
+
+/* Number of spaces per depth level */
+#define INDENT_WIDTH 4
+
+/* End of `n' tags */
+static inline void
+emit_close(uint32_t n, enum Layout layout)
+{
+	if (layout == LAYOUT_HANG)
+		return;
+
+	const uint32_t max = sizeof(close_run) - 1;
+	for (; n > max; n -= max)
+		fwrite(close_run, max, 1, stdout);
+	if (n != 0)
+		fwrite(close_run, n, 1, stdout);
+}
+
+/* Separator of tags; `depth' is the depth of the next tag */
+static inline void
+emit_break(uint32_t depth, enum Layout layout)
+{
+	if (layout == LAYOUT_LINE) {
+		putchar(depth == 0 ? '\n' : ' ');
+		return;
+	}
+
+	const size_t max = sizeof(indent_run) - 1; /* newline and spaces */
+	size_t n = 1 + INDENT_WIDTH * (size_t) depth;
+
+	if (n <= max) {
+		fwrite(indent_run, n, 1, stdout);
+		return;
+	}
+
+	fwrite(indent_run, max, 1, stdout);
+	for (n -= max; n > max - 1; n -= max - 1)
+		fwrite(indent_run + 1, max - 1, 1, stdout);
+	if (n != 0)
+		fwrite(indent_run + 1, n, 1, stdout);
+}
+
+/*
+ * Remove "drained off" capacities (see `drop_drained_capacities') and
+ * print the ends of that many tags.
+ */
+static inline void
+close_drained_containers(struct DecSt *z, enum Layout layout)
+{
+	emit_close(drop_drained_capacities(z), layout);
+}
+
+/* Delete all capacities, making `z->caps' list empty */
+static void
+drop_capacities(struct DecSt *z)
+{
+	list_splice_init(&z->caps, &z->spare_caps);
+	z->depth = 0;
 }
 
 #ifdef DEBUG
@@ -462,21 +675,268 @@ debug_show_decoder_state(const struct DecSt *z, const struct Stream *str,
 #  define debug_show_decoder_state(...)
 #endif
 
-IterV
-decode(struct DecSt *z, struct Stream *master)
+void
+free_DecSt(struct DecSt *z)
 {
-	static bool header_p = true; /* Do we parse tag header at this step? */
-	static struct ASN1_Header tag;
+	if (z == NULL)
+		return;
 
-	if (master->type == S_EOF) {
-		if (z->depth == 0) {
-			return IE_DONE;
-		} else {
-			set_error(master, "Unexpected EOF");
+	if (z->buf_repr != NULL) {
+		free(buffer_data(z->buf_repr));
+		free(z->buf_repr);
+	}
+
+	if (z->buf_raw != NULL) {
+		free(buffer_data(z->buf_raw));
+		free(z->buf_raw);
+	}
+
+	drop_capacities(z);
+
+	struct list_head *p, *t;
+	list_for_each_safe(p, t, &z->spare_caps)
+		free(list_entry(p, struct Capacity, h));
+
+	free(z);
+}
+
+void
+reset_DecSt(struct DecSt *z)
+{
+	drop_capacities(z);
+
+	if (z->buf_repr != NULL)
+		buffer_reset(z->buf_repr);
+	if (z->buf_raw != NULL)
+		buffer_reset(z->buf_raw);
+
+	__reset_DecSt(z);
+}
+
+int
+recover_DecSt(struct DecSt *z)
+{
+	if (!z->root_p)
+		return -1;
+
+	/*
+	 * Skip the remains of the record, if top-level header is intact
+	 * and its length is known.
+	 */
+	z->skip = z->depth == 0 ||
+		list_entry(z->caps.prev, struct Capacity, h)->indef_p ?
+		0 : capacity(z->caps.prev);
+	z->resync_p = true;
+	z->skipped = 0;
+	z->dangling = z->depth;
+	drop_capacities(z);
+
+	z->header_p = true;
+	z->hdr_cont = 0;
+	z->lead_want = 0;
+	return 0;
+}
+
+size_t
+skipped_DecSt(struct DecSt *z)
+{
+	if (z->resync_p)
+		return 0;
+
+	const size_t n = z->skipped;
+	z->skipped = 0;
+	return n;
+}
+
+/*
+ * Handle the end of stream.
+ *
+ * It is an error for the stream to end in the middle of a record.
+ */
+static IterV
+decode_eof(struct DecSt *z, struct Stream *master)
+{
+	z->resync_p = false; /* nothing to look for */
+
+	/* hdr_cont == 1: no identifier octet has been read yet */
+	if (z->depth == 0 && z->skip == 0 && z->hdr_cont <= 1)
+		return IE_DONE;
+
+	set_error(master, "Unexpected EOF");
+	return IE_CONT;
+}
+
+int
+parse_header(struct ASN1_Header *tag, const uint8_t *src, size_t n)
+{
+	const uint8_t *p = src;
+	const uint8_t *end = src + n;
+
+	if (p == end)
+		return 0;
+
+	tag->cls = (*p & 0xc0) >> 6;
+	tag->cons_p = (*p & 0x20) != 0;
+	if ((tag->num = *p++ & 0x1f) == 0x1f) {
+		tag->num = 0;
+		do {
+			if (p == end)
+				return 0;
+			if (tag->num & 0xff800000)
+				return -1; /* exceeds 30 bits */
+			tag->num = (tag->num << 7) | (*p & 0x7f);
+		} while (*p++ & 0x80);
+	}
+
+	if (p == end)
+		return 0;
+	if (*p == 0xff || *p == 0x80)
+		return -1;
+
+	if (*p & 0x80) {
+		size_t len_sz = *p++ & 0x7f;
+		if (len_sz > 8)
+			return -1;
+		if ((size_t) (end - p) < len_sz)
+			return 0;
+
+		for (tag->len = 0; len_sz > 0; --len_sz)
+			tag->len = (tag->len << 8) | *p++;
+	} else {
+		tag->len = *p++;
+	}
+
+	return p - src;
+}
+
+/*
+ * Is there a plausible top-level tag header at `src'?
+ *
+ * The header should be canonically encoded and its first child (if
+ * any) should fit in.  Anything that does not fit in `n' bytes is
+ * given the benefit of the doubt.
+ */
+static bool
+plausible_root_p(const struct DecSt *z, const uint8_t *src, size_t n)
+{
+	struct ASN1_Header tag, child;
+
+	const int hsize = parse_header(&tag, src, n);
+	if (hsize == 0)
+		return true;
+	else if (hsize < 0 || (size_t) hsize != header_size(&tag) ||
+		 tag.num != z->root.num || tag.len == 0)
+		return false;
+
+	if (!tag.cons_p)
+		return true;
+
+	src += hsize;
+	n = MIN(n - hsize, tag.len);
+
+	const int csize = parse_header(&child, src, n);
+	if (csize == 0)
+		return n < tag.len;
+	return csize > 0 && csize + child.len <= tag.len;
+}
+
+/* Remember attributes of top-level tags, unless they are known already */
+static inline void
+learn_root(struct DecSt *z)
+{
+	if (!z->root_p) {
+		z->root = z->tag;
+		z->root_p = true;
+	}
+}
+
+/*
+ * Skip the input until the next top-level tag (see `recover_DecSt').
+ */
+static IterV
+resync(struct DecSt *z, struct Stream *master)
+{
+	size_t n = MIN(z->skip, master->size);
+	master->data += n;
+	master->size -= n;
+	z->skip -= n;
+	z->skipped += n;
+
+	if (z->skip != 0)
+		return IE_CONT;
+
+	const uint8_t id = (z->root.cls << 6) | (z->root.cons_p ? 0x20 : 0) |
+		(z->root.num <= 30 ? z->root.num : 0x1f);
+
+	for (;;) {
+		const uint8_t *p = memchr(master->data, id, master->size);
+		n = p == NULL ? master->size : (size_t) (p - master->data);
+
+		master->data += n;
+		master->size -= n;
+		z->skipped += n;
+
+		if (p == NULL)
 			return IE_CONT;
-		}
+
+		if (plausible_root_p(z, master->data, master->size))
+			break;
+
+		++master->data;
+		--master->size;
+		++z->skipped;
+	}
+
+	z->resync_p = false;
+	return IE_DONE;
+}
+
+/*
+ * Parse tag header from the master stream, restricting the parser to
+ * the capacity of current container.
+ */
+static IterV
+next_header(struct DecSt *z, struct Stream *master)
+{
+	struct Stream str; /* Substream being passed to `decode_header' */
+	str.type = master->type;
+	str.data = master->data;
+	str.errmsg = master->errmsg;
+
+	const size_t orig_size = z->depth == 0 ?
+		master->size : MIN(remcap(z), master->size);
+	str.size = orig_size;
+
+	const IterV indic = decode_header(z, &str);
+	decrease_capacities(orig_size - str.size, z);
+
+	master->data = str.data;
+	master->size -= orig_size - str.size;
+	master->errmsg = str.errmsg;
+
+	if (indic == IE_CONT && z->depth > 0 && remcap(z) == 0)
+		beyond_container(z, master);
+
+	return indic;
+}
+
+/* See `decode' */
+static inline __attribute__((always_inline)) IterV
+decode_chunk(struct DecSt *z, struct Stream *master, const enum Layout layout)
+{
+	if (z->dangling != 0) {
+		/* Close the containers of broken record */
+		emit_close(z->dangling, layout);
+		z->dangling = 0;
+		putchar('\n');
 	}
 
+	if (master->type == S_EOF)
+		return decode_eof(z, master);
+
+	if (z->resync_p && resync(z, master) == IE_CONT)
+		return IE_CONT;
+
 	struct Stream str; /* Substream being passed to an iteratee */
 	str.type = master->type;
 	str.data = master->data;
@@ -486,18 +946,13 @@ decode(struct DecSt *z, struct Stream *master)
 		const size_t orig_size = z->depth == 0 ?
 			master->size : MIN(remcap(z), master->size);
 		str.size = orig_size;
-		debug_show_decoder_state(z, &str, master, " %s", header_p ?
+		debug_show_decoder_state(z, &str, master, " %s", z->header_p ?
 					 "decode_header" : "print_prim");
 
-		const IterV indic = header_p
-#ifdef FILLERS
-			? decode_header(&tag, &str, z->depth == 0)
-#else
-			? decode_header(&tag, &str)
-#endif
+		const IterV indic = z->header_p
+			? decode_header(z, &str)
 			: print_prim(&str, remcap(z) <= str.size,
-				     repr_from_raw(z->repr, tag.cls, tag.num),
-				     z);
+				     z->decode, z);
 		assert(indic == IE_DONE || indic == IE_CONT);
 
 		decrease_capacities(orig_size - str.size, z);
@@ -510,51 +965,338 @@ decode(struct DecSt *z, struct Stream *master)
 
 		if (indic == IE_CONT) {
 			if (z->depth > 0 && remcap(z) == 0)
-				set_error(master, "Trying to go beyond the"
-					  " end of container");
+				beyond_container(z, master);
 
 			return IE_CONT;
 		}
 
 		/* IE_DONE */
-		if (header_p) {
-			putchar('(');
-			repr_show_header(z->repr, tag.cls, tag.num);
+		if (z->header_p) {
+			/*
+			 * The end of indefinite-length container is not
+			 * known in advance, so the break after its last
+			 * child is held back till the next header.
+			 */
+			const bool eoc = eoc_p(z);
+			if (z->break_p) {
+				z->break_p = false;
+				if (!eoc)
+					emit_break(z->depth, layout);
+			}
 
-			if (tag.len == 0) {
-				fputs(tag.cons_p ? " ()" : " \"\"", stdout);
-				add_capacity(0, z);
+			if (eoc) {
+				/* Empty contents, unless ':' is emitted */
+				if (z->empty_p && layout != LAYOUT_HANG)
+					emit_empty(true, layout);
+				z->empty_p = false;
+
+				drop_indefinite(z);
+				emit_close(1, layout);
+				close_drained_containers(z, layout);
+				goto line_feed;
+			}
+			z->empty_p = z->tag.indef_p;
+
+			if (z->depth == 0)
+				learn_root(z);
+
+			z->tag_repr = repr_find(z->repr, z->depth == 0 ? NULL :
+						list_first_entry(&z->caps,
+								 struct Capacity,
+								 h)->repr,
+						z->depth == 0, z->tag.cls,
+						z->tag.num);
+
+			z->decode = repr_from_raw(z->tag_repr);
+			if (z->decode == NULL && (z->flags & CF_TYPED))
+				z->decode = universal_decoder(
+					z->tag.cls == TC_UNIVERSAL ?
+					z->tag.num : repr_utag(z->tag_repr));
+
+			emit_open(layout);
+			repr_show(z->tag_repr, z->tag.cls, z->tag.num);
+
+			if (z->tag.indef_p) {
+				if (add_indefinite(z, master) != 0)
+					return IE_CONT;
+				emit_cons(layout);
+				goto line_feed;
+			}
+
+			if (z->tag.len == 0) {
+				emit_empty(z->tag.cons_p, layout);
+				if (add_capacity(0, z, master) != 0)
+					return IE_CONT;
 			}
 
-			close_drained_containers(z);
+			close_drained_containers(z, layout);
 
-			if (tag.len == 0)
+			if (z->tag.len == 0)
 				goto line_feed;
 
-			if (!contained_p(tag.len, z)) {
+			if (!contained_p(z->tag.len, z)) {
+				if (z->flags & CF_KEEP_GOING) {
+					/* Close it up, then resynchronize */
+					emit_empty(z->tag.cons_p, layout);
+					emit_close(1, layout);
+				}
 				set_error(master, "Tag is too big for its"
 					  " container");
 				return IE_CONT;
 			}
-			add_capacity(tag.len, z);
+			if (add_capacity(z->tag.len, z, master) != 0)
+				return IE_CONT;
 
-			if (!tag.cons_p) {
-				header_p = false;
+			if (!z->tag.cons_p) {
+				z->header_p = false;
 				putchar(' ');
 				continue;
 			}
+			emit_cons(layout);
 		} else {
-			close_drained_containers(z);
-			header_p = true;
+			close_drained_containers(z, layout);
+			z->header_p = true;
 		}
 
 line_feed:
-		putchar('\n');
-		uint32_t i;
-		for (i = 0; i < z->depth; ++i)
-			fputs("    ", stdout);
+		if (indefinite_p(z))
+			z->break_p = true;
+		else
+			emit_break(z->depth, layout);
 	}
 
 	assert(0 == 1);
 	return -1; /* never reached */
 }
+
+IterV
+decode(struct DecSt *z, struct Stream *master)
+{
+	if (z->flags & CF_LINE)
+		return decode_chunk(z, master, LAYOUT_LINE);
+	else if (z->flags & CF_HANG)
+		return decode_chunk(z, master, LAYOUT_HANG);
+	else
+		return decode_chunk(z, master, LAYOUT_DEFAULT);
+}
+
+/*
+ * Check DER restrictions on the encoding of universal types, whose
+ * header has just been parsed, and arrange for the leading contents
+ * octets to be collected (see `check_lead').
+ *
+ * Return -1 if restrictions are violated, otherwise return 0.
+ */
+static int
+check_universal(struct DecSt *z, struct Stream *master)
+{
+	const struct ASN1_Header *tag = &z->tag;
+
+	switch (tag->num) {
+	case UT_BOOLEAN:
+		if (tag->cons_p || tag->len != 1) {
+			set_error(master, "BOOLEAN value must be encoded as"
+				  " a single primitive octet\n"
+				  "  [ITU-T X.690, 8.2.1]");
+			return -1;
+		}
+		break;
+
+	case UT_INTEGER:
+	case UT_ENUMERATED:
+		if (tag->cons_p || tag->len == 0) {
+			set_error(master, "INTEGER value must be encoded as"
+				  " one or more primitive octets\n"
+				  "  [ITU-T X.690, 8.3.1, 8.4]");
+			return -1;
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	z->lead_want = MIN(tag->len, sizeof(z->lead));
+	z->lead_len = 0;
+	return 0;
+}
+
+/*
+ * Collect leading contents octets of the value and check them
+ * against DER restrictions, once there are enough of them.
+ *
+ * Return -1 if restrictions are violated, otherwise return 0.
+ */
+static int
+check_lead(struct DecSt *z, struct Stream *master)
+{
+	/* Copy the octets, leaving them in the stream */
+	const size_t n = MIN((size_t) (z->lead_want - z->lead_len),
+			     master->size);
+	memcpy(z->lead + z->lead_len, master->data, n);
+	z->lead_len += n;
+
+	if (z->lead_len < z->lead_want)
+		return 0; /* need more data */
+	z->lead_want = 0;
+
+	const uint8_t *p = z->lead;
+	if (z->tag.num == UT_BOOLEAN) {
+		if (*p != 0 && *p != 0xff) {
+			set_error(master, "BOOLEAN value is not canonical:"
+				  " %02x\n  [ITU-T X.690, 11.1]", *p);
+			return -1;
+		}
+	} else if (z->lead_len == 2 && ((*p == 0 && !(p[1] & 0x80)) ||
+					(*p == 0xff && p[1] & 0x80))) {
+		set_error(master, "INTEGER value is not encoded in the"
+			  " minimum number of octets\n"
+			  "  [ITU-T X.690, 8.3.2]");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Remove "drained off" capacities, reporting the ends of constructed
+ * encodings to `z->cb'.
+ *
+ * @prim_p: is the innermost capacity the one of a primitive encoding?
+ */
+static int
+end_drained_containers(struct DecSt *z, bool prim_p, struct Stream *master)
+{
+	if (z->cb == NULL || z->cb->end == NULL) {
+		drop_drained_capacities(z);
+		return 0;
+	}
+
+	for (; z->depth != 0 && remcap(z) == 0 && !indefinite_p(z);
+	     prim_p = false) {
+		list_move(z->caps.next, &z->spare_caps);
+		--z->depth;
+
+		if (!prim_p && z->cb->end(z->cb_ctx, z->depth) != 0) {
+			set_error(master, "Stopped by `end' handler");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Report an empty (zero-length) value to `z->cb' */
+static int
+empty_value(struct DecSt *z, struct Stream *master)
+{
+	const struct Walk_Callbacks *cb = z->cb;
+
+	if (z->tag.cons_p) {
+		if (cb->end != NULL && cb->end(z->cb_ctx, z->depth) != 0) {
+			set_error(master, "Stopped by `end' handler");
+			return -1;
+		}
+	} else if (cb->primitive != NULL &&
+		   cb->primitive(z->cb_ctx, NULL, 0, true) != 0) {
+		set_error(master, "Stopped by `primitive' handler");
+		return -1;
+	}
+
+	return 0;
+}
+
+IterV
+walk(struct DecSt *z, struct Stream *master)
+{
+	const struct Walk_Callbacks *cb = z->cb;
+	z->dangling = 0;
+
+	if (master->type == S_EOF)
+		return decode_eof(z, master);
+
+	if (z->resync_p && resync(z, master) == IE_CONT)
+		return IE_CONT;
+
+	for (;;) {
+		if (!z->header_p) {
+			if (z->lead_want != 0 && check_lead(z, master) != 0)
+				return IE_CONT;
+
+			/* Pass primitive contents without looking at them */
+			const size_t n = MIN(remcap(z), master->size);
+			if (n != 0 && cb != NULL && cb->primitive != NULL &&
+			    cb->primitive(z->cb_ctx, master->data, n,
+					  n == remcap(z)) != 0) {
+				set_error(master, "Stopped by `primitive'"
+					  " handler");
+				return IE_CONT;
+			}
+
+			master->data += n;
+			master->size -= n;
+			decrease_capacities(n, z);
+
+			if (remcap(z) != 0)
+				return IE_CONT;
+
+			if (end_drained_containers(z, true, master) != 0)
+				return IE_CONT;
+			z->header_p = true;
+		}
+
+		if (next_header(z, master) == IE_CONT)
+			return IE_CONT;
+
+		if (eoc_p(z)) {
+			drop_indefinite(z);
+
+			if (cb != NULL && cb->end != NULL &&
+			    cb->end(z->cb_ctx, z->depth) != 0) {
+				set_error(master, "Stopped by `end' handler");
+				return IE_CONT;
+			}
+
+			if (end_drained_containers(z, false, master) != 0)
+				return IE_CONT;
+			continue;
+		}
+
+		if (z->depth == 0)
+			learn_root(z);
+
+		if (!contained_p(z->tag.len, z)) {
+			set_error(master, "Tag is too big for its container");
+			return IE_CONT;
+		}
+
+		if (z->flags & CF_STRICT && z->tag.cls == TC_UNIVERSAL &&
+		    check_universal(z, master) != 0)
+			return IE_CONT;
+
+		if (cb != NULL && cb->header != NULL &&
+		    cb->header(z->cb_ctx, &z->tag, z->depth) != 0) {
+			set_error(master, "Stopped by `header' handler");
+			return IE_CONT;
+		}
+
+		if (z->tag.indef_p) {
+			if (add_indefinite(z, master) != 0)
+				return IE_CONT;
+			continue;
+		}
+
+		if (z->tag.len == 0) {
+			if (cb != NULL && empty_value(z, master) != 0)
+				return IE_CONT;
+
+			if (end_drained_containers(z, false, master) != 0)
+				return IE_CONT;
+			continue;
+		}
+
+		if (add_capacity(z->tag.len, z, master) != 0)
+			return IE_CONT;
+		z->header_p = z->tag.cons_p;
+	}
+}
@@ -10,9 +10,30 @@
 
 #include "list.h"
 #include "iteratee.h"
+#include "asn1.h"
+#include "repr.h"
 
 struct Buffer;
 
+/*
+ * Handlers of decoding events (see `walk').
+ *
+ * These are the handlers of libunder (`struct Under_Callbacks')
+ * with internal types; libunder.c maps one to the other.
+ */
+struct Walk_Callbacks {
+	int (*header)(void *ctx, const struct ASN1_Header *tag,
+		      uint32_t depth);
+	int (*primitive)(void *ctx, const uint8_t *data, size_t n,
+			 bool final);
+	int (*end)(void *ctx, uint32_t depth);
+};
+
+struct under_header;
+
+/* Convert tag header to its libunder representation (see libunder.c) */
+void export_header(struct under_header *dest, const struct ASN1_Header *src);
+
 /* Decoding state */
 struct DecSt {
 	uint32_t depth; /* Current depth within tag hierarchy */
@@ -24,6 +45,7 @@ struct DecSt {
 	 * container (tag).
 	 */
 	struct list_head caps;
+	struct list_head spare_caps; /* Unused capacities, kept for reuse */
 
 	/*
 	 * Pointer to a structure that specifies how to convert tag
@@ -32,20 +54,116 @@ struct DecSt {
 	 */
 	const struct Repr_Format *repr;
 
+	unsigned flags; /* Codec options (see `enum Codec_Flag') */
+
 	struct Buffer *buf_repr; /* Human-friendly representation receiver */
 	struct Buffer *buf_raw; /* Raw bytes accumulator */
+
+	bool header_p; /* Is tag header being parsed at this step? */
+	struct ASN1_Header tag; /* Attributes of the latest tag */
+	const struct Repr *tag_repr; /* Representation of the latest tag */
+	Repr_Codec decode; /* Decoder of its primitive contents (or NULL) */
+
+	int hdr_cont; /* Position to continue header parsing from */
+	size_t len_sz; /* Number of length octets left to parse */
+	unsigned nocts; /* Number of subsequent tag number/length octets */
+
+	bool break_p; /* Is a break held back?  See `decode_chunk' */
+	bool empty_p; /* Has an indefinite-length container no children yet? */
+
+	int prim_cont; /* Position to continue printing contents from */
+	int hexdump_cont; /* Position to continue hexdump from */
+
+	/*
+	 * Leading contents octets of a primitive value that is
+	 * subject to DER restrictions (CF_STRICT mode only).
+	 */
+	uint8_t lead[2];
+	uint8_t lead_want; /* Number of leading octets to collect */
+	uint8_t lead_len; /* Number of octets collected */
+
+	/*
+	 * Error recovery (see `recover_DecSt').
+	 */
+	size_t skip; /* Number of bytes to skip before resuming */
+	bool resync_p; /* Are we looking for the next top-level tag? */
+	size_t skipped; /* Number of bytes skipped since the error */
+	uint32_t dangling; /* Number of containers left unclosed */
+
+	/* Attributes of top-level tags (known if `root_p' is true) */
+	struct ASN1_Header root;
+	bool root_p;
+
+	/* Handlers of decoding events (see `walk'); can be NULL */
+	const struct Walk_Callbacks *cb;
+	void *cb_ctx; /* Argument to pass to the handlers */
 };
 
-static inline void init_DecSt(struct DecSt *z, const struct Repr_Format *repr)
+/* Reset parsing state; see `reset_DecSt' */
+static inline void __reset_DecSt(struct DecSt *z)
 {
 	z->depth = 0;
+	z->header_p = true;
+	z->tag_repr = NULL;
+	z->decode = NULL;
+	z->hdr_cont = 0;
+	z->len_sz = z->skip = z->skipped = 0;
+	z->nocts = 0;
+	z->break_p = z->empty_p = false;
+	z->prim_cont = z->hexdump_cont = 0;
+	z->lead_want = z->lead_len = 0;
+	z->resync_p = false;
+	z->dangling = 0;
+
+	z->root.cons_p = true;
+	z->root_p = repr_root(z->repr, &z->root.cls, &z->root.num) == 0;
+}
+
+static inline void init_DecSt(struct DecSt *z, const struct Repr_Format *repr,
+			      unsigned flags)
+{
 	INIT_LIST_HEAD(&z->caps);
+	INIT_LIST_HEAD(&z->spare_caps);
 	z->repr = repr;
+	z->flags = flags;
 	z->buf_repr = z->buf_raw = NULL;
+
+	__reset_DecSt(z);
+
+	z->cb = NULL;
+	z->cb_ctx = NULL;
 }
 
+/*
+ * Prepare decoder for processing another input from scratch.
+ *
+ * Allocated buffers and capacities are kept for reuse.
+ */
+void reset_DecSt(struct DecSt *z);
+
 void free_DecSt(struct DecSt *z);
 
+/*
+ * Abandon the record being processed, so that decoding could be
+ * resumed from the next top-level tag.
+ *
+ * The remains of the broken record are skipped (if its length is
+ * known), then the data are scanned for the identifier octet of
+ * top-level tags.  A header found is accepted as the start of next
+ * record if its encoding is canonical and its first child fits in.
+ *
+ * Return -1 if the attributes of top-level tags are unknown (neither
+ * format specification nor previous records define them), otherwise
+ * return 0.
+ */
+int recover_DecSt(struct DecSt *z);
+
+/*
+ * Return the number of bytes skipped during the recovery, and reset
+ * the counter, once decoding is resumed; otherwise return 0.
+ */
+size_t skipped_DecSt(struct DecSt *z);
+
 /*
  * Decode DER data.
  *
@@ -58,5 +176,37 @@ void free_DecSt(struct DecSt *z);
  */
 IterV decode(struct DecSt *z, struct Stream *master);
 
+/*
+ * Parse tag header in a memory region and store decoded attributes
+ * in a `*tag'.
+ *
+ * Unlike `decode', this function is not resumable: the header is
+ * expected to reside in the region entirely.
+ *
+ * Return the size of header, 0 if the region is too short to contain
+ * the header, or -1 if the header is invalid.  Indefinite length is
+ * not supported (-1 is returned).
+ */
+int parse_header(struct ASN1_Header *tag, const uint8_t *src, size_t n);
+
+/*
+ * Walk the structure of DER data, passing decoding events to the
+ * handlers `z->cb'.  With no handlers, this function
+ * only validates the data, producing no output.
+ *
+ * Tag headers are parsed and checked against the capacities of
+ * their containers; primitive contents are passed to the handler (or
+ * skipped) by length without being looked at.
+ *
+ * Constructed encodings of indefinite length (BER) are accepted,
+ * unless in CF_STRICT mode; they end with end-of-contents octets,
+ * which are not reported to the handlers.
+ *
+ * In CF_STRICT mode the encodings are also checked for conformance
+ * to DER restrictions: minimal tag number and length octets, definite
+ * length, canonical BOOLEAN and INTEGER values.
+ */
+IterV walk(struct DecSt *z, struct Stream *master);
+
 
 #endif /* _DECODER_H */
@@ -6,11 +6,17 @@
  * published by the Free Software Foundation.
  */
 #include <stdio.h>
-#include <ctype.h>
 #include <assert.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #include "encoder.h"
 #include "asn1.h"
+#include "universal.h"
+#include "pem.h"
+#include "codec.h"
 #include "util.h"
 
 #ifndef _BSD_SOURCE
@@ -26,180 +32,30 @@
 # endif
 #endif
 
+static struct Flat *new_flats(unsigned n, size_t max_size,
+			      const struct Repr_Format *repr);
+static void free_flats(struct Flat *fs, unsigned n);
+
 void
-init_EncSt(struct EncSt *z)
+init_EncSt(struct EncSt *z, const struct Repr_Format *repr, unsigned flags)
 {
 	INIT_BUFFER(&z->acc);
 	buffer_resize(&z->acc, 1024);
+	INIT_BUFFER(&z->text);
+	INIT_BUFFER(&z->raw);
+	INIT_BUFFER(&z->record);
+	z->njobs = MAX(encoder_jobs, 1U);
+	z->flat = new_flats(z->njobs, z->acc._max_size, repr);
+	z->armor = flags & CF_PEM ? pem_label : NULL;
+	z->repr = repr;
 	INIT_LIST_HEAD(&z->bt);
-}
-
-void
-free_EncSt(struct EncSt *z)
-{
-	if (z == NULL)
-		return;
-
-	free(buffer_data(&z->acc));
-	free(z);
-}
-
-static inline bool
-_isspace(uint8_t c)
-{
-	return isspace(c);
-}
-
-/* Parse '\s*\(' regexp */
-static IterV
-left_bracket(struct Stream *str)
-{
-	if (drop_while(_isspace, str) == IE_CONT)
-		return IE_CONT;
-
-	if (*str->data != '(') {
-		set_error(str, "`(' expected");
-		return IE_CONT;
-	}
-
-	++str->data;
-	--str->size;
-	return IE_DONE;
-}
-
-/* Parse '\s*[)(]' regexp, saving met bracket in `*c' */
-static IterV
-any_bracket(uint8_t *c, struct Stream *str)
-{
-        if (drop_while(_isspace, str) == IE_CONT)
-                return IE_CONT;
-
-        if (*str->data != ')' && *str->data != '(') {
-		set_error(str, "`)' or `(' expected");
-		return IE_CONT;
-	}
-
-	*c = *str->data;
-
-	++str->data;
-	--str->size;
-	return IE_DONE;
-}
-
-/* Parse '(' or '"' character */
-static IterV
-contents_type(bool *consp, struct Stream *str)
-{
-	assert(str->size > 0); /* not a kosher iteratee */
-
-	if (*str->data == '(') {
-		*consp = true;
-	} else if (*str->data == '"') {
-		*consp = false;
-	} else {
-		set_error(str, "`(' or `\"' expected");
-		return IE_CONT;
-	}
-
-	++str->data;
-	--str->size;
-	return IE_DONE;
-}
-
-/* Parse '\s*[uacp)]' regexp */
-static IterV
-read_tag_class(enum Tag_Class *dest, bool *nil, struct Stream *str)
-{
-	if (drop_while(_isspace, str) == IE_CONT)
-		return IE_CONT;
-
-	switch (*str->data) {
-	case 'u': *dest = TC_UNIVERSAL; break;
-	case 'a': *dest = TC_APPLICATION; break;
-	case 'c': *dest = TC_CONTEXT; break;
-	case 'p': *dest = TC_PRIVATE; break;
-	case ')': *nil = true; break;
-	default:
-		set_error(str, "Invalid tag class specification");
-		return IE_CONT;
-	}
-
-	++str->data;
-	--str->size;
-	return IE_DONE;
-}
-
-/* Parse '[0-9]+\s' regexp */
-static IterV
-read_tag_number(uint32_t *dest, struct Stream *str)
-{
-	static uint32_t n = 0; /* number of parsed digits */
-
-	for (; str->size > 0 && isdigit(*str->data);
-	     ++str->data, --str->size) {
-		if (++n > 10) {
-			set_error(str, "Invalid tag number: too many digits");
-			return IE_CONT;
-		}
-
-		*dest = 10*(*dest) + (*str->data - '0');
-	}
-
-	if (str->size == 0)
-		return IE_CONT;
-
-	if (n == 0) {
-		set_error(str, "Digit expected");
-		return IE_CONT;
-	}
-	n = 0;
-
-	if (!isspace(*str->data)) {
-		set_error(str, "White-space character expected");
-		return IE_CONT;
-	}
-	++str->data;
-	--str->size;
-
-	if (*dest & 0xc0000000) { /* tagnum exceeds 30 bits */
-		set_error(str, "Enormous tag number", *dest);
-		return IE_CONT;
-	}
-
-	return IE_DONE;
-}
-
-/* Parse '\s*([uacp][0-9]+\s+|\))' regexp */
-IterV
-read_header(struct ASN1_Header *tag, bool *nil, struct Stream *str)
-{
-	static int cont = 0;
-
-	switch (cont) {
-	case 0:
-		if (read_tag_class(&tag->cls, nil, str) == IE_CONT)
-			return IE_CONT;
-		if (*nil)
-			break;
-
-		tag->num = 0;
-		++cont;
-	case 1:
-		if (read_tag_number(&tag->num, str) == IE_CONT)
-			return IE_CONT;
-
-		++cont;
-	case 2:
-		if (drop_while(_isspace, str) == IE_CONT)
-			return IE_CONT;
-
-		break;
-	default:
-		assert(0 == 1);
-	}
-
-	cont = 0;
-	return IE_DONE;
+	z->state = z->comment_ret = 0; /* P_ROOT */
+	z->ndigits = 0;
+	z->nibble = 0;
+	z->offset = z->bol = 0;
+	z->line = 1;
+	INIT_LIST_HEAD(&z->spare_frames);
+	z->spare_nodes = NULL;
 }
 
 static int
@@ -228,105 +84,6 @@ struct Pstring {
 	size_t size;
 };
 
-/* Parse '\s*([0-9a-fA-F]{2}(\s+[0-9a-fA-F]{2})*\s*)?"' regexp */
-static IterV
-primval(struct Pstring *dest, struct Buffer *acc, struct Stream *str)
-{
-	static uint8_t nibble = 0;
-	static bool expect_space = false;
-
-	uint8_t c;
-	for (;;) {
-		if (head(&c, str) == IE_CONT)
-			return IE_CONT;
-
-		if (nibble == 0) {
-			if (c == '"') {
-				expect_space = false;
-				return IE_DONE;
-			}
-
-			if (isspace(c)) {
-				expect_space = false;
-				if (drop_while(_isspace, str) == IE_CONT)
-					return IE_CONT;
-
-				c = *str->data;
-				++str->data;
-				--str->size;
-
-				if (c == '"')
-					return IE_DONE;
-			} else if (expect_space) {
-				set_error(str, "White-space character"
-					  " expected");
-				return IE_CONT;
-			}
-		}
-
-		if (!isxdigit(c)) {
-			set_error(str, "Hexadecimal digit expected");
-			return IE_CONT;
-		}
-
-		if (nibble == 0) {
-			nibble = c;
-			continue;
-		} else {
-			const char s[] = { nibble, c, 0 };
-			if (store1(acc, strtoul(s, NULL, 16), str) != 0)
-				return IE_CONT;
-			++dest->size;
-
-			nibble = 0;
-			expect_space = true;
-		}
-	}
-}
-
-/*
- * Read a primitive value, updating `*dest' p-string.
- * Parse '\s*([0-9a-fA-F]{2}(\s+[0-9a-fA-F]{2})*\s*)?"\s*\)' regexp.
- */
-static IterV
-read_primitive(struct Pstring *dest, struct EncSt *z, struct Stream *str)
-{
-	static int cont = 0;
-
-	switch (cont) {
-	case 0:
-		dest->data = z->acc.wptr;
-		dest->size = 0;
-
-		++cont;
-	case 1:
-		if (primval(dest, &z->acc, str) == IE_CONT)
-			return IE_CONT;
-
-		++cont;
-	case 2:
-		if (drop_while(_isspace, str) == IE_CONT)
-			return IE_CONT;
-
-		if (*str->data != ')') {
-			set_error(str, "`)' expected");
-			return IE_CONT;
-		}
-		++str->data;
-		--str->size;
-
-		break;
-	default:
-		assert(0 == 1);
-		return -1;
-	}
-
-	debug_print("read_primitive: %lu bytes encoded",
-		    (unsigned long) dest->size);
-	cont = 0;
-	return IE_DONE;
-}
-
 /*
  * Append encoding of "high" tag number to accumulator.
  * Note, that the first argument is expected to be greater than 30.
@@ -416,6 +173,14 @@ encode_header(union U_Header *io, struct Buffer *acc, struct Stream *str)
 	return 0;
 }
 
+int
+encode_der_header(const struct ASN1_Header *h, struct Buffer *dest,
+		  struct Stream *str)
+{
+	union U_Header io = { .rec = *h };
+	return encode_header(&io, dest, str);
+}
+
 /* Node of the ``encoding tree'' */
 struct Node {
 	struct Node *next, /* Next sibling; NULL for the last node */
@@ -478,135 +243,70 @@ at_root_frame(const struct EncSt *z)
 static void
 push_frame(struct Node *target, struct EncSt *dest)
 {
-	struct Frame *new = xmalloc(sizeof(struct Frame));
-	INIT_LIST_HEAD(&new->h);
+	struct Frame *new;
+	if (list_empty(&dest->spare_frames)) {
+		new = xmalloc(sizeof(struct Frame));
+		list_add(&new->h, &dest->bt);
+	} else {
+		new = list_first_entry(&dest->spare_frames, struct Frame, h);
+		list_move(&new->h, &dest->bt);
+	}
 	new->node = target;
-
-	list_add(&new->h, &dest->bt);
 }
 
 static void
 pop_frame(struct EncSt *z)
 {
 	assert(!list_empty(&z->bt));
-
-	struct list_head *p = z->bt.next;
-	__list_del(p->prev, p->next);
-	free(p);
+	list_move(z->bt.next, &z->spare_frames);
 }
 
-IterV
-read_tree(struct EncSt *z, struct Stream *str)
+/* Allocate zero-filled node, reusing a released one if possible */
+static struct Node *
+new_node(struct EncSt *z)
 {
-	assert(str->type == S_CHUNK);
-	static int cont = 0;
-
-	struct Node *cur = curnode(z);
-	bool nil; /* true for empty values -- `()', false otherwise */
-
-	switch (cont) {
-	case 0:
-		assert(list_empty(&z->bt));
-
-		if (left_bracket(str) == IE_CONT)
-			return IE_CONT;
-
-		cur = new_zeroed(struct Node);
-		push_frame(cur, z);
-
-header:
-		++cont;
-	case 1:
-		nil = false;
-		if (read_header(&cur->header.rec, &nil, str) == IE_CONT)
-			return IE_CONT;
-
-		if (nil) {
-			if (at_root_frame(z)) {
-				pop_frame(z);
-				break;
-			} else {
-				goto tag_end;
-			}
-		}
-
-		++cont;
-	case 2:
-		if (contents_type(&cur->header.rec.cons_p, str) == IE_CONT)
-			return IE_CONT;
-
-		if (cur->header.rec.cons_p) {
-			cur = cur->child = new_zeroed(struct Node);
-			push_frame(cur, z);
-
-			goto header;
-		}
-
-		cur->contents = new_zeroed(struct Pstring);
-
-		++cont;
-	case 3:
-		if (read_primitive(cur->contents, z, str) == IE_CONT)
-			return IE_CONT;
-		cur->header.rec.len = cur->contents->size;
-
-		if (at_root_frame(z))
-			break;
-
-		if (encode_header(&cur->header, &z->acc, str) != 0)
-			return IE_CONT; /* error */
-		*parent_len(z) += cur->header.enc.size + cur->contents->size;
+	struct Node *n = z->spare_nodes;
 
-tag_end:
-		++cont;
-	case 4:
-		for (;;) {
-			uint8_t c;
-			if (any_bracket(&c, str) == IE_CONT)
-				return IE_CONT;
-			pop_frame(z);
-
-			if (c == ')') {
-				if (at_root_frame(z))
-					break;
-				cur = curnode(z);
+	if (n == NULL)
+		return new_zeroed(struct Node);
 
-				*parent_len(z) += cur->header.rec.len;
-				if (encode_header(&cur->header, &z->acc, str)
-				    != 0)
-					return IE_CONT; /* error */
+	z->spare_nodes = n->next;
+	memset(n, 0, sizeof(*n));
+	return n;
+}
 
-				*parent_len(z) += cur->header.enc.size;
-			} else if (c == '(') {
-				cur = cur->next = new_zeroed(struct Node);
-				push_frame(cur, z);
+static inline void
+release_node(struct Node *n, struct EncSt *z)
+{
+	n->next = z->spare_nodes;
+	z->spare_nodes = n;
+}
 
-				goto header;
-			} else {
-				assert(0 == 1);
-			}
-		}
+/* Release the nodes of (partially built) encoding tree */
+static void
+release_tree(struct Node *root, struct EncSt *z)
+{
+	while (root != NULL) {
+		struct Node *next = root->next;
 
-		break;
-	default:
-		assert(0 == 1);
-	}
+		release_tree(root->child, z);
+		free(root->contents);
+		release_node(root, z);
 
-	if (!list_empty(&z->bt)) {
-		assert(at_root_frame(z));
-		if (encode_header(&curnode(z)->header, &z->acc, str) != 0)
-			return IE_CONT;
+		root = next;
 	}
-
-	cont = 0;
-	return IE_DONE;
 }
 
-/* Write Pascal string to stdout */
+/* Write Pascal string to stdout (or to the record to be armored) */
 static inline void
-putps(const struct Pstring *s)
+putps(struct EncSt *z, const struct Pstring *s)
 {
-	fwrite(s->data, s->size, 1, stdout);
+	if (z->armor == NULL)
+		fwrite(s->data, s->size, 1, stdout);
+	else if (buffer_reserve(&z->record, s->size) == 0)
+		buffer_put(&z->record, s->data, s->size);
+	else
+		die("Out of memory, buffer_reserve failed");
 }
 
 /* Write encoded data to stdout; free allocated resources */
@@ -616,10 +316,10 @@ write_tree(struct EncSt *z)
 	assert(at_root_frame(z));
 
 	struct Node *cur;
-	for (; (cur = curnode(z)) != NULL; free(cur)) {
-		putps(&cur->header.enc);
+	for (; (cur = curnode(z)) != NULL; release_node(cur, z)) {
+		putps(z, &cur->header.enc);
 		if (cur->contents != NULL) {
-			putps(cur->contents);
+			putps(z, cur->contents);
 			free(cur->contents);
 		}
 
@@ -637,27 +337,1288 @@ write_tree(struct EncSt *z)
 	}
 
 	buffer_reset(&z->acc);
+
+	if (z->armor != NULL) {
+		pem_write(stdout, z->armor, buffer_data(&z->record),
+			  buffer_len(&z->record));
+		buffer_reset(&z->record);
+	}
 }
 
-IterV
-encode(struct EncSt *z, struct Stream *str)
+/*
+ * Parser
+ *
+ * Input is recognized by a single deterministic finite automaton.
+ * Each byte is mapped to its kind (`byte_kind'); the pair of parser
+ * state and byte kind selects an action (`actions').  The state is
+ * kept in `struct EncSt', so parsing can be resumed at any byte.
+ */
+
+/* Kinds of input bytes */
+enum Byte_Kind {
+	K_OTHER,
+	K_BLANK, /* white-space character other than newline */
+	K_NEWLINE,
+	K_LPAREN,
+	K_RPAREN,
+	K_QUOTE,
+	K_DIGIT,
+	K_XALPHA, /* [bdefA-F] */
+	K_CLASS, /* [up] */
+	K_XCLASS, /* [ac] -- tag class or hexadecimal digit */
+	K_SEMICOLON, /* start of comment */
+	K_LBRACKET,
+	K_RBRACKET,
+	K_BACKSLASH,
+	K_X, /* `x' of `\xHH' escape sequence */
+	NR_KINDS
+};
+
+static const uint8_t byte_kind[256] = {
+	[' '] = K_BLANK, ['\t'] = K_BLANK, ['\v' ... '\r'] = K_BLANK,
+	['\n'] = K_NEWLINE,
+	['('] = K_LPAREN, [')'] = K_RPAREN, ['"'] = K_QUOTE,
+	['0' ... '9'] = K_DIGIT,
+	['b'] = K_XALPHA, ['d' ... 'f'] = K_XALPHA, ['A' ... 'F'] = K_XALPHA,
+	['u'] = K_CLASS, ['p'] = K_CLASS,
+	['a'] = K_XCLASS, ['c'] = K_XCLASS,
+	[';'] = K_SEMICOLON,
+	['['] = K_LBRACKET, [']'] = K_RBRACKET, ['\\'] = K_BACKSLASH,
+	['x'] = K_X
+};
+
+/* Values of hexadecimal digits */
+static const uint8_t xvalue[256] = {
+	['0'] = 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+	['a'] = 10, 11, 12, 13, 14, 15,
+	['A'] = 10, 11, 12, 13, 14, 15
+};
+
+/* States of parser; comments show the input expected */
+enum Parser_State {
+	P_ROOT, /* \s*\( */
+	P_CLASS, /* \s*[uacp)] */
+	P_NUM0, /* [0-9] */
+	P_NUM, /* [0-9]|\s */
+	P_TYPE, /* \s*[("[] */
+	P_HEX, /* \s*[0-9a-fA-F"] */
+	P_NIBBLE, /* [0-9a-fA-F] */
+	P_SEP, /* [\s"] */
+	P_CLOSE, /* \s*\) */
+	P_NEXT, /* \s*[)(] */
+	P_COMMENT, /* [^\n]*\n */
+	P_TEXT, /* [^\n] */
+	P_ESCAPE, /* [\\\]x] */
+	P_XESC, /* [0-9a-fA-F] */
+	P_XESC2, /* [0-9a-fA-F] */
+	NR_STATES
+};
+
+/* Actions of parser */
+enum Parser_Action {
+	A_ERROR, /* unexpected byte */
+	A_SPACE, /* skip white space */
+	A_COMMENT, /* skip (the rest of) comment */
+	A_ROOT, /* start a record */
+	A_CLASS, /* tag class */
+	A_NIL, /* empty value -- `()' */
+	A_DIGIT, /* digit of tag number */
+	A_NUM_END, /* end of tag number */
+	A_CONS, /* start constructed contents */
+	A_PRIM, /* start primitive contents */
+	A_NIBBLE, /* the first digit of octet */
+	A_OCTET, /* the second digit of octet */
+	A_SEP, /* separator of octets */
+	A_QUOTE, /* end of primitive contents */
+	A_PRIM_END, /* end of primitive encoding */
+	A_CLOSE, /* end of constructed encoding */
+	A_SIBLING, /* start the next sibling */
+	A_TEXT, /* start typed representation of primitive contents */
+	A_CHARS, /* characters of typed representation */
+	A_ESCAPE, /* start of escape sequence */
+	A_ESCAPED, /* escaped character */
+	A_XESC, /* start of escaped octet */
+	A_XNIBBLE, /* the first digit of escaped octet */
+	A_XOCTET, /* the second digit of escaped octet */
+	A_TEXT_END /* end of typed representation */
+};
+
+/* White space and comments are allowed between tokens (not in strings) */
+#define SPACE [K_BLANK] = A_SPACE, [K_NEWLINE] = A_SPACE, \
+		[K_SEMICOLON] = A_COMMENT
+#define XDIGIT(a) [K_DIGIT] = (a), [K_XALPHA] = (a), [K_XCLASS] = (a)
+
+static const uint8_t actions[NR_STATES][NR_KINDS] = {
+	[P_ROOT] = { SPACE, [K_LPAREN] = A_ROOT },
+	[P_CLASS] = { SPACE, [K_CLASS] = A_CLASS, [K_XCLASS] = A_CLASS,
+		      [K_RPAREN] = A_NIL },
+	[P_NUM0] = { [K_DIGIT] = A_DIGIT },
+	[P_NUM] = { [K_DIGIT] = A_DIGIT, [K_BLANK] = A_NUM_END,
+		    [K_NEWLINE] = A_NUM_END, [K_SEMICOLON] = A_NUM_END },
+	[P_TYPE] = { SPACE, [K_LPAREN] = A_CONS, [K_QUOTE] = A_PRIM,
+		     [K_LBRACKET] = A_TEXT },
+	[P_HEX] = { [K_BLANK] = A_SPACE, [K_NEWLINE] = A_SPACE,
+		    XDIGIT(A_NIBBLE), [K_QUOTE] = A_QUOTE },
+	[P_NIBBLE] = { XDIGIT(A_OCTET) },
+	[P_SEP] = { [K_BLANK] = A_SEP, [K_NEWLINE] = A_SEP,
+		    [K_QUOTE] = A_QUOTE },
+	[P_CLOSE] = { SPACE, [K_RPAREN] = A_PRIM_END },
+	[P_NEXT] = { SPACE, [K_RPAREN] = A_CLOSE, [K_LPAREN] = A_SIBLING },
+	[P_COMMENT] = { [0 ... NR_KINDS - 1] = A_COMMENT },
+	[P_TEXT] = { [K_OTHER] = A_CHARS, [K_BLANK] = A_CHARS,
+		     [K_LPAREN] = A_CHARS, [K_RPAREN] = A_CHARS,
+		     [K_QUOTE] = A_CHARS, XDIGIT(A_CHARS),
+		     [K_CLASS] = A_CHARS, [K_SEMICOLON] = A_CHARS,
+		     [K_LBRACKET] = A_CHARS, [K_X] = A_CHARS,
+		     [K_RBRACKET] = A_TEXT_END, [K_BACKSLASH] = A_ESCAPE },
+	[P_ESCAPE] = { [K_BACKSLASH] = A_ESCAPED, [K_RBRACKET] = A_ESCAPED,
+		       [K_X] = A_XESC },
+	[P_XESC] = { XDIGIT(A_XNIBBLE) },
+	[P_XESC2] = { XDIGIT(A_XOCTET) }
+};
+
+#undef XDIGIT
+#undef SPACE
+
+/* Error messages, reported when a byte is unexpected */
+static const char *const unexpected[NR_STATES] = {
+	[P_ROOT] = "`(' expected",
+	[P_CLASS] = "Invalid tag class specification",
+	[P_NUM0] = "Digit expected",
+	[P_NUM] = "White-space character expected",
+	[P_TYPE] = "`(', `\"' or `[' expected",
+	[P_HEX] = "Hexadecimal digit expected",
+	[P_NIBBLE] = "Hexadecimal digit expected",
+	[P_SEP] = "White-space character expected",
+	[P_CLOSE] = "`)' expected",
+	[P_NEXT] = "`)' or `(' expected",
+	[P_TEXT] = "`]' expected",
+	[P_ESCAPE] = "Invalid escape sequence",
+	[P_XESC] = "Hexadecimal digit expected",
+	[P_XESC2] = "Hexadecimal digit expected"
+};
+
+/*
+ * Return the number of leading white-space characters, newline
+ * excluded.
+ */
+static size_t
+blank_span(const uint8_t *src, size_t n)
 {
-	if (str->type == S_EOF) {
-		if (list_empty(&z->bt)) {
-			return IE_DONE;
-		} else {
-			set_error(str, "Unexpected EOF");
-			return IE_CONT;
-		}
+	const uint8_t *p = src;
+	const uint8_t * const end = src + n;
+
+	/* Most runs are short: a separator or an indentation */
+	const uint8_t * const short_end = n < 16 ? end : src + 16;
+	while (p != short_end && byte_kind[*p] == K_BLANK)
+		++p;
+	if (p != short_end)
+		return p - src;
+
+#ifdef __SSE2__
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i four = _mm_set1_epi8('\r' - '\t');
+
+	for (; end - p >= 16; p += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) p);
+
+		/* '\t' <= c <= '\r' is checked as (c - '\t') <= 4U */
+		const __m128i d = _mm_sub_epi8(v, tab);
+		const __m128i ctl = _mm_andnot_si128(
+			_mm_cmpeq_epi8(v, newline),
+			_mm_cmpeq_epi8(_mm_min_epu8(d, four), d));
+
+		const unsigned mask = _mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(v, space), ctl));
+		if (mask != 0xffff)
+			return p - src + __builtin_ctz(~mask);
 	}
+#endif
 
-	for (;;) {
-		if (read_tree(z, str) == IE_CONT)
-			return IE_CONT;
+	while (p != end && byte_kind[*p] == K_BLANK)
+		++p;
 
-		if (!list_empty(&z->bt)) {
-			write_tree(z);
-			assert(list_empty(&z->bt));
-		}
+	return p - src;
+}
+
+static inline enum Tag_Class
+tag_class(uint8_t c)
+{
+	switch (c) {
+	case 'u': return TC_UNIVERSAL;
+	case 'a': return TC_APPLICATION;
+	case 'c': return TC_CONTEXT;
+	default: return TC_PRIVATE;
+	}
+}
+
+/* Encode the header of root node and write the record to stdout */
+static int
+finish_record(struct EncSt *z, struct Stream *str)
+{
+	assert(at_root_frame(z));
+
+	if (encode_header(&curnode(z)->header, &z->acc, str) != 0)
+		return -1;
+
+	write_tree(z);
+	assert(list_empty(&z->bt));
+	return 0;
+}
+
+/* Append unescaped text of typed representation */
+static int
+store_text(struct EncSt *z, const void *src, size_t n, struct Stream *str)
+{
+	if (buffer_reserve(&z->text, n) != 0) {
+		set_error(str, "Out of memory, buffer_reserve failed");
+		return -1;
+	}
+
+	return buffer_put(&z->text, src, n);
+}
+
+/*
+ * Return the encoder of typed representation of a tag.  Tags of other
+ * classes are typed if the ASN.1 module gives their type (`r' is their
+ * representation there).
+ */
+static inline Repr_Codec
+typed_encoder(uint8_t cls, uint32_t num, const struct Repr *r)
+{
+	return universal_encoder(cls == TC_UNIVERSAL ? num : repr_utag(r));
+}
+
+/* Find representation of the current node, starting from the root */
+static const struct Repr *
+node_repr(const struct EncSt *z)
+{
+	const struct Repr *r = NULL;
+	const struct list_head *x;
+
+	for (x = z->bt.prev; x != &z->bt; x = x->prev) {
+		const struct ASN1_Header *h =
+			&list_entry(x, struct Frame, h)->node->header.rec;
+		r = repr_find(z->repr, r, x == z->bt.prev, h->cls, h->num);
+	}
+	return r;
+}
+
+/* Encode typed representation of primitive contents (see universal.h) */
+static int
+encode_text(struct EncSt *z, struct Node *node, struct Stream *str)
+{
+	const struct ASN1_Header *h = &node->header.rec;
+	const Repr_Codec encode = typed_encoder(h->cls, h->num,
+		h->cls == TC_UNIVERSAL ? NULL : node_repr(z));
+
+	if (encode == NULL) {
+		set_error(str, "%c%u has no typed representation",
+			  "uacp"[h->cls], h->num);
+		return -1;
+	}
+
+	buffer_reset(&z->raw);
+	if (encode(&z->raw, buffer_data(&z->text), buffer_len(&z->text))
+	    != 0) {
+		set_error(str, "%s", buffer_data(&z->raw));
+		return -1;
 	}
+
+	node->contents = new_zeroed(struct Pstring);
+	node->contents->data = z->acc.wptr;
+	node->contents->size = buffer_len(&z->raw);
+
+	return store(&z->acc, buffer_data(&z->raw), buffer_len(&z->raw), str);
+}
+
+/*
+ * Parse a chunk of input, writing records as soon as they are
+ * encoded.
+ *
+ * In case of error `str->data' points to the offending byte.
+ */
+static void
+parse(struct EncSt *z, struct Stream *str)
+{
+	const uint8_t *p = str->data;
+	const uint8_t * const end = p + str->size;
+	enum Parser_State state = z->state;
+	struct Node *cur = curnode(z);
+
+	while (p != end) {
+		const uint8_t c = *p;
+
+		switch (actions[state][byte_kind[c]]) {
+		case A_ERROR:
+			set_error(str, "%s", unexpected[state]);
+			goto out;
+
+		case A_SPACE:
+			do {
+				if (*p == '\n') {
+					++z->line;
+					z->bol = z->offset + (p + 1 - str->data);
+				}
+				++p;
+				p += blank_span(p, end - p);
+			} while (p != end && *p == '\n');
+			continue;
+
+		case A_COMMENT: {
+			if (state != P_COMMENT) {
+				z->comment_ret = state;
+				state = P_COMMENT;
+			}
+
+			/* The newline is left to be parsed as white space */
+			const uint8_t *eol = memchr(p, '\n', end - p);
+			if (eol == NULL) {
+				p = end;
+			} else {
+				p = eol;
+				state = z->comment_ret;
+			}
+			continue;
+		}
+
+		case A_ROOT:
+			assert(list_empty(&z->bt));
+			cur = new_node(z);
+			push_frame(cur, z);
+			state = P_CLASS;
+			break;
+
+		case A_CLASS:
+			cur->header.rec.cls = tag_class(c);
+			cur->header.rec.num = 0;
+			z->ndigits = 0;
+			state = P_NUM0;
+			break;
+
+		case A_NIL:
+			if (at_root_frame(z)) {
+				pop_frame(z);
+				release_node(cur, z);
+				state = P_ROOT;
+			} else {
+				state = P_NEXT;
+			}
+			break;
+
+		case A_DIGIT:
+			if (++z->ndigits > 10) {
+				set_error(str, "Invalid tag number: too many"
+					  " digits");
+				goto out;
+			}
+			cur->header.rec.num = 10*cur->header.rec.num + (c - '0');
+			state = P_NUM;
+			break;
+
+		case A_NUM_END:
+			if (cur->header.rec.num & 0xc0000000) {
+				/* tagnum exceeds 30 bits */
+				set_error(str, "Enormous tag number");
+				goto out;
+			}
+			state = P_TYPE;
+			continue; /* white space is skipped in P_TYPE state */
+
+		case A_CONS:
+			cur->header.rec.cons_p = true;
+			cur = cur->child = new_node(z);
+			push_frame(cur, z);
+			state = P_CLASS;
+			break;
+
+		case A_PRIM:
+			cur->header.rec.cons_p = false;
+			cur->contents = new_zeroed(struct Pstring);
+			cur->contents->data = z->acc.wptr;
+			state = P_HEX;
+			break;
+
+		case A_NIBBLE:
+			z->nibble = c;
+			state = P_NIBBLE;
+			break;
+
+		case A_OCTET:
+			if (store1(&z->acc, xvalue[z->nibble] << 4 | xvalue[c],
+				   str) != 0)
+				goto out;
+			++cur->contents->size;
+			state = P_SEP;
+			break;
+
+		case A_SEP:
+			state = P_HEX;
+			continue; /* white space is skipped in P_HEX state */
+
+		case A_QUOTE:
+			state = P_CLOSE;
+			break;
+
+		case A_PRIM_END:
+			cur->header.rec.len = cur->contents->size;
+			debug_print("parse: %lu bytes of primitive contents",
+				    (unsigned long) cur->contents->size);
+
+			if (at_root_frame(z)) {
+				if (finish_record(z, str) != 0)
+					goto out;
+				state = P_ROOT;
+				break;
+			}
+
+			if (encode_header(&cur->header, &z->acc, str) != 0)
+				goto out;
+			*parent_len(z) += cur->header.enc.size +
+				cur->contents->size;
+			state = P_NEXT;
+			break;
+
+		case A_CLOSE:
+			pop_frame(z);
+
+			if (at_root_frame(z)) {
+				if (finish_record(z, str) != 0)
+					goto out;
+				state = P_ROOT;
+				break;
+			}
+
+			cur = curnode(z);
+			*parent_len(z) += cur->header.rec.len;
+			if (encode_header(&cur->header, &z->acc, str) != 0)
+				goto out;
+			*parent_len(z) += cur->header.enc.size;
+			break;
+
+		case A_SIBLING:
+			pop_frame(z);
+
+			cur = cur->next = new_node(z);
+			push_frame(cur, z);
+			state = P_CLASS;
+			break;
+
+		case A_TEXT:
+			cur->header.rec.cons_p = false;
+			buffer_reset(&z->text);
+			state = P_TEXT;
+			break;
+
+		case A_CHARS: {
+			const uint8_t *q = p;
+			while (q != end && *q != ']' && *q != '\\' &&
+			       *q != '\n')
+				++q;
+
+			if (store_text(z, p, q - p, str) != 0)
+				goto out;
+			p = q;
+			continue;
+		}
+
+		case A_ESCAPE:
+			state = P_ESCAPE;
+			break;
+
+		case A_ESCAPED:
+			if (store_text(z, &c, 1, str) != 0)
+				goto out;
+			state = P_TEXT;
+			break;
+
+		case A_XESC:
+			state = P_XESC;
+			break;
+
+		case A_XNIBBLE:
+			z->nibble = c;
+			state = P_XESC2;
+			break;
+
+		case A_XOCTET: {
+			const uint8_t x = xvalue[z->nibble] << 4 | xvalue[c];
+			if (store_text(z, &x, 1, str) != 0)
+				goto out;
+			state = P_TEXT;
+			break;
+		}
+
+		case A_TEXT_END:
+			if (encode_text(z, cur, str) != 0)
+				goto out;
+			state = P_CLOSE;
+			break;
+
+		default:
+			assert(0 == 1);
+		}
+
+		++p;
+	}
+
+out:
+	z->offset += p - str->data;
+	z->state = state;
+	str->size -= p - str->data;
+	str->data = p;
+}
+
+/*
+ * Length-first encoding
+ *
+ * When a chunk of input holds whole records (e.g., the input file is
+ * mapped into memory), they are encoded without building the encoding
+ * tree.  The first pass (`measure') validates the records with the
+ * parser's automaton and computes the lengths of their tags; the second
+ * pass (`emit') writes DER linearly into a buffer of exactly the right
+ * size.  Whatever the first pass does not accept -- an incomplete or
+ * invalid record, or one that would not fit in the accumulator -- is
+ * left to `parse', so the results (and error messages) are the same.
+ */
+
+/* Tag of length-first encoding */
+struct Flat_Tag {
+	size_t len; /* Length of contents */
+	uint32_t num; /* Tag number */
+	uint8_t cls; /* Tag class (`enum Tag_Class') */
+};
+
+/* State of length-first encoding; there is one per job */
+struct Flat {
+	struct Flat_Tag *tags; /* Tags of the records, in order of appearance */
+	size_t ntags, maxtags;
+	size_t *open; /* Ordinals of the tags being parsed, outermost first */
+	size_t maxopen;
+	struct Buffer text; /* Typed representation being parsed */
+	struct Buffer raw; /* Its encoding */
+	struct Buffer typed; /* Encodings of typed representations */
+	struct Buffer out; /* DER encoding of the records */
+	size_t max_size; /* Maximal size of record's encoding */
+	const struct Repr_Format *repr; /* See `EncSt.repr' */
+
+	/* Shard of input (see `encode_parallel') */
+	const uint8_t *src;
+	size_t size;
+	size_t done; /* Number of bytes encoded */
+	unsigned long nlines; /* Number of newlines in them */
+	size_t bol; /* Offset of the byte following the last newline */
+	pthread_t thread;
+};
+
+/* Ordinal of `()' -- the value that is not encoded */
+#define FLAT_NIL SIZE_MAX
+
+/* Amount of input the first pass starts records in */
+#define FLAT_WINDOW (4 * 1024 * 1024)
+
+unsigned encoder_jobs = 1;
+
+static struct Flat *
+new_flats(unsigned n, size_t max_size, const struct Repr_Format *repr)
+{
+	struct Flat *fs = xmalloc(n * sizeof(struct Flat));
+	memset(fs, 0, n * sizeof(struct Flat));
+
+	unsigned i;
+	for (i = 0; i < n; ++i) {
+		fs[i].max_size = max_size;
+		fs[i].repr = repr;
+	}
+	return fs;
+}
+
+static void
+free_flats(struct Flat *fs, unsigned n)
+{
+	unsigned i;
+	for (i = 0; i < n; ++i) {
+		free(fs[i].tags);
+		free(fs[i].open);
+		free(buffer_data(&fs[i].text));
+		free(buffer_data(&fs[i].raw));
+		free(buffer_data(&fs[i].typed));
+		free(buffer_data(&fs[i].out));
+	}
+	free(fs);
+}
+
+static size_t
+new_flat_tag(struct Flat *f, uint8_t cls)
+{
+	if (f->ntags == f->maxtags) {
+		f->maxtags = f->maxtags == 0 ? 256 : 2 * f->maxtags;
+		f->tags = xrealloc(f->tags,
+				   f->maxtags * sizeof(struct Flat_Tag));
+	}
+
+	struct Flat_Tag *t = f->tags + f->ntags;
+	t->len = 0;
+	t->num = 0;
+	t->cls = cls;
+	return f->ntags++;
+}
+
+static void
+push_open(struct Flat *f, size_t *depth, size_t k)
+{
+	if (*depth == f->maxopen) {
+		f->maxopen = f->maxopen == 0 ? 32 : 2 * f->maxopen;
+		f->open = xrealloc(f->open, f->maxopen * sizeof(size_t));
+	}
+	f->open[(*depth)++] = k;
+}
+
+#ifdef __SSE2__
+/* Mask of separators in 16 ``hh '' triplets of hexadecimal octets */
+static const uint8_t triplet_seps[48] __attribute__((aligned(16))) = {
+	0,0,0xff, 0,0,0xff, 0,0,0xff, 0,0,0xff, 0,0,0xff, 0,0,0xff,
+	0,0,0xff, 0,0,0xff, 0,0,0xff, 0,0,0xff, 0,0,0xff, 0,0,0xff,
+	0,0,0xff, 0,0,0xff, 0,0,0xff, 0,0,0xff
+};
+
+/* Test whether 48 bytes at `p' are 16 octets separated by spaces */
+static inline bool
+hex_triplets_p(const uint8_t *p)
+{
+	const __m128i zero1 = _mm_set1_epi8('0' - 1);
+	const __m128i nine1 = _mm_set1_epi8('9' + 1);
+	const __m128i a1 = _mm_set1_epi8('a' - 1);
+	const __m128i f1 = _mm_set1_epi8('f' + 1);
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i space = _mm_set1_epi8(' ');
+
+	for (int i = 0; i < 48; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+		const __m128i sep = _mm_load_si128(
+			(const __m128i *) (triplet_seps + i));
+		const __m128i l = _mm_or_si128(v, lower);
+
+		const __m128i hex = _mm_or_si128(
+			_mm_and_si128(_mm_cmpgt_epi8(v, zero1),
+				      _mm_cmplt_epi8(v, nine1)),
+			_mm_and_si128(_mm_cmpgt_epi8(l, a1),
+				      _mm_cmplt_epi8(l, f1)));
+		const __m128i ok = _mm_or_si128(
+			_mm_and_si128(sep, _mm_cmpeq_epi8(v, space)),
+			_mm_andnot_si128(sep, hex));
+
+		if (_mm_movemask_epi8(ok) != 0xffff)
+			return false;
+	}
+	return true;
+}
+#endif
+
+/* Find representation of the innermost of `depth' open tags */
+static const struct Repr *
+flat_repr(const struct Flat *f, size_t depth)
+{
+	const struct Repr *r = NULL;
+	size_t i;
+
+	for (i = 0; i < depth; ++i) {
+		const struct Flat_Tag *t = f->tags + f->open[i];
+		r = repr_find(f->repr, r, i == 0, t->cls, t->num);
+	}
+	return r;
+}
+
+static inline size_t
+flat_header_size(const struct Flat_Tag *t)
+{
+	const struct ASN1_Header h = { .num = t->num, .len = t->len };
+	return header_size(&h);
+}
+
+/* Append unescaped text of typed representation; see `store_text' */
+static inline int
+measure_text(struct Flat *f, const void *src, size_t n)
+{
+	return buffer_reserve(&f->text, n) == 0 ?
+		buffer_put(&f->text, src, n) : -1;
+}
+
+/*
+ * Pass one: find whole records at the start of `src', computing the
+ * lengths of their tags (`f->tags') and encoding typed representations
+ * (`f->typed').
+ *
+ * Return the number of bytes the records take; `*size' is set to the
+ * size of their DER encoding.
+ */
+static size_t
+measure(struct Flat *f, const uint8_t *src, size_t n, size_t *size)
+{
+	const uint8_t *p = src;
+	const uint8_t * const end = src + n;
+	const uint8_t *done = src; /* end of the last whole record */
+	enum Parser_State state = P_ROOT, comment_ret = P_ROOT;
+	size_t depth = 0; /* number of elements in `f->open' */
+	unsigned ndigits = 0;
+	uint8_t nibble = 0;
+	struct Flat_Tag *t = NULL; /* the innermost tag */
+	size_t enc; /* size of encoding of the tag being closed */
+
+	f->ntags = 0;
+	buffer_reset(&f->typed);
+	*size = 0;
+
+	while (p != end) {
+		const uint8_t c = *p;
+
+		switch (actions[state][byte_kind[c]]) {
+		case A_ERROR:
+			goto out;
+
+		case A_SPACE:
+			++p;
+			p += blank_span(p, end - p);
+			continue;
+
+		case A_COMMENT: {
+			if (state != P_COMMENT) {
+				comment_ret = state;
+				state = P_COMMENT;
+			}
+
+			const uint8_t *eol = memchr(p, '\n', end - p);
+			if (eol == NULL)
+				goto out;
+			p = eol;
+			state = comment_ret;
+			continue;
+		}
+
+		case A_ROOT:
+			if (p - src >= FLAT_WINDOW)
+				goto out;
+			push_open(f, &depth, FLAT_NIL);
+			state = P_CLASS;
+			break;
+
+		case A_CLASS:
+			f->open[depth - 1] = new_flat_tag(f, tag_class(c));
+			t = f->tags + f->open[depth - 1];
+			ndigits = 0;
+			state = P_NUM0;
+			break;
+
+		case A_NIL:
+			if (depth == 1) {
+				depth = 0;
+				done = p + 1;
+				state = P_ROOT;
+			} else {
+				state = P_NEXT;
+			}
+			break;
+
+		case A_DIGIT:
+			if (++ndigits > 10)
+				goto out;
+			t->num = 10*t->num + (c - '0');
+			state = P_NUM;
+			break;
+
+		case A_NUM_END:
+			if (t->num & 0xc0000000)
+				goto out;
+			state = P_TYPE;
+			continue;
+
+		case A_CONS:
+			push_open(f, &depth, FLAT_NIL);
+			state = P_CLASS;
+			break;
+
+		case A_PRIM:
+			state = P_HEX;
+			break;
+
+		case A_NIBBLE:
+#ifdef __SSE2__
+			if (end - p >= 48 && hex_triplets_p(p)) {
+				t->len += 16;
+				p += 48;
+				continue;
+			}
+#endif
+			nibble = c;
+			state = P_NIBBLE;
+			break;
+
+		case A_OCTET:
+			++t->len;
+			state = P_SEP;
+			break;
+
+		case A_SEP:
+			state = P_HEX;
+			continue;
+
+		case A_QUOTE:
+			state = P_CLOSE;
+			break;
+
+		case A_CLOSE:
+			--depth;
+			t = f->tags + f->open[depth - 1];
+			/* FALLTHROUGH */
+		case A_PRIM_END:
+			enc = flat_header_size(t) + t->len;
+			if (depth == 1) {
+				if (enc > f->max_size)
+					goto out; /* `parse' will report it */
+				*size += enc;
+				depth = 0;
+				done = p + 1;
+				state = P_ROOT;
+				break;
+			}
+
+			t = f->tags + f->open[depth - 2];
+			t->len += enc;
+			state = P_NEXT;
+			break;
+
+		case A_SIBLING:
+			f->open[depth - 1] = FLAT_NIL;
+			state = P_CLASS;
+			break;
+
+		case A_TEXT:
+			buffer_reset(&f->text);
+			state = P_TEXT;
+			break;
+
+		case A_CHARS: {
+			const uint8_t *q = p;
+			while (q != end && *q != ']' && *q != '\\' &&
+			       *q != '\n')
+				++q;
+
+			if (measure_text(f, p, q - p) != 0)
+				goto out;
+			p = q;
+			continue;
+		}
+
+		case A_ESCAPE:
+			state = P_ESCAPE;
+			break;
+
+		case A_ESCAPED:
+			if (measure_text(f, &c, 1) != 0)
+				goto out;
+			state = P_TEXT;
+			break;
+
+		case A_XESC:
+			state = P_XESC;
+			break;
+
+		case A_XNIBBLE:
+			nibble = c;
+			state = P_XESC2;
+			break;
+
+		case A_XOCTET: {
+			const uint8_t x = xvalue[nibble] << 4 | xvalue[c];
+			if (measure_text(f, &x, 1) != 0)
+				goto out;
+			state = P_TEXT;
+			break;
+		}
+
+		case A_TEXT_END: {
+			const Repr_Codec encode = typed_encoder(t->cls, t->num,
+				t->cls == TC_UNIVERSAL ? NULL :
+				flat_repr(f, depth));
+
+			buffer_reset(&f->raw);
+			if (encode == NULL ||
+			    encode(&f->raw, buffer_data(&f->text),
+				   buffer_len(&f->text)) != 0 ||
+			    buffer_reserve(&f->typed, buffer_len(&f->raw)) != 0)
+				goto out;
+
+			t->len = buffer_len(&f->raw);
+			buffer_put(&f->typed, buffer_data(&f->raw), t->len);
+			state = P_CLOSE;
+			break;
+		}
+
+		default:
+			assert(0 == 1);
+		}
+
+		++p;
+	}
+
+out:
+	return done - src;
+}
+
+/* Skip white space and comments */
+static inline const uint8_t *
+skip_space(const uint8_t *p, const uint8_t *end)
+{
+	for (;; ++p) {
+		if (*p == ';')
+			p = memchr(p, '\n', end - p);
+		else if (byte_kind[*p] != K_BLANK && *p != '\n')
+			return p;
+	}
+}
+
+/* Find `]' that ends typed representation */
+static inline const uint8_t *
+text_end(const uint8_t *p, const uint8_t *end)
+{
+	for (;; ++p) {
+		p = memchr(p, ']', end - p);
+
+		/* `]' is escaped if preceded by odd number of backslashes */
+		const uint8_t *q = p;
+		while (q[-1] == '\\')
+			--q;
+		if ((p - q) % 2 == 0)
+			return p;
+	}
+}
+
+/*
+ * Pass two: write DER encoding of the records found by `measure'
+ * to `dest'.  Return the end of encoding.
+ */
+static uint8_t *
+emit(const struct Flat *f, const uint8_t *src, size_t n, uint8_t *dest)
+{
+	const uint8_t *p = src;
+	const uint8_t * const end = src + n;
+	const struct Flat_Tag *t = f->tags;
+	const uint8_t *typed = buffer_data(&f->typed);
+	struct Stream str = STREAM_INIT;
+
+	while (p != end) {
+		switch (*p) {
+		case 'u': case 'a': case 'c': case 'p':
+			break;
+
+		case ';':
+			p = memchr(p, '\n', end - p);
+			continue;
+
+		default: /* white space or parenthesis */
+			++p;
+			continue;
+		}
+
+		for (++p; byte_kind[*p] == K_DIGIT; ++p)
+			;
+		p = skip_space(p, end);
+
+		const struct ASN1_Header h = {
+			.cls = t->cls, .num = t->num, .cons_p = *p == '(',
+			.len = t->len
+		};
+		struct Buffer b = { dest, 16, 16 };
+		encode_der_header(&h, &b, &str);
+		dest = b.wptr;
+
+		if (*p == '"') {
+			for (++p;; p += 2) {
+				while (byte_kind[*p] == K_BLANK || *p == '\n')
+					++p;
+				if (*p == '"')
+					break;
+				*dest++ = xvalue[p[0]] << 4 | xvalue[p[1]];
+			}
+			++p;
+		} else if (*p == '[') {
+			p = text_end(p + 1, end) + 1;
+
+			memcpy(dest, typed, t->len);
+			dest += t->len;
+			typed += t->len;
+		}
+
+		++t;
+	}
+
+	return dest;
+}
+
+/*
+ * Encode whole records at the start of `src', appending the encoding
+ * to `f->out'.  Return the number of bytes encoded.
+ */
+static size_t
+encode_window(struct Flat *f, const uint8_t *src, size_t n)
+{
+	size_t size;
+	if ((n = measure(f, src, n, &size)) == 0)
+		return 0;
+
+	if (buffer_reserve(&f->out, size) != 0)
+		die("Out of memory, buffer_reserve failed");
+
+	uint8_t *e = emit(f, src, n, f->out.wptr);
+	assert((size_t) (e - f->out.wptr) == size);
+	f->out.wptr = e;
+	f->out.size -= size;
+
+	const uint8_t *q = src, *eol;
+	while ((eol = memchr(q, '\n', src + n - q)) != NULL) {
+		++f->nlines;
+		q = eol + 1;
+		f->bol = q - f->src;
+	}
+
+	return n;
+}
+
+/* Write the encoding; account for the input consumed */
+static void
+flush_flat(struct EncSt *z, struct Flat *f, struct Stream *str)
+{
+	if (buffer_len(&f->out) != 0) {
+		fwrite(buffer_data(&f->out), buffer_len(&f->out), 1, stdout);
+		buffer_reset(&f->out);
+	}
+
+	if (f->nlines != 0) {
+		z->line += f->nlines;
+		z->bol = z->offset + f->bol;
+	}
+
+	z->offset += f->done;
+	str->data += f->done;
+	str->size -= f->done;
+}
+
+/* Encode the whole records at the start of `str' length-first */
+static void
+encode_flat(struct EncSt *z, struct Stream *str)
+{
+	struct Flat *f = z->flat;
+
+	do {
+		f->src = str->data;
+		f->nlines = 0;
+		f->done = encode_window(f, str->data, str->size);
+		flush_flat(z, f, str);
+	} while (f->done != 0);
+}
+
+/*
+ * Parallel encoding
+ *
+ * Records are independent of each other, so large input is cut into
+ * shards at the boundaries of top-level forms.  Each job encodes its
+ * shard to a private buffer; the buffers are written in order.  A shard
+ * that is not encoded in full (e.g., because of invalid record) ends
+ * the parallel encoding: the following shards are discarded and the
+ * rest of input is left to `parse'.
+ */
+
+/* Approximate size of a shard */
+#define SHARD_SIZE FLAT_WINDOW
+
+/*
+ * Find the end of the first top-level form that ends at least `min'
+ * bytes past `p'.  The end of data is returned if there is none.
+ *
+ * Only brackets are counted, so the boundary is correct if the data
+ * are valid; otherwise the invalid record is detected by `measure'.
+ */
+static const uint8_t *
+shard_end(const uint8_t *p, const uint8_t *end, size_t min)
+{
+	const uint8_t * const start = p;
+	size_t depth = 0;
+
+	while (p != end) {
+		switch (*p) {
+		case '(':
+			++depth;
+			break;
+
+		case ')':
+			if (depth != 0 && --depth == 0 &&
+			    (size_t) (p - start) >= min)
+				return p + 1;
+			break;
+
+		case '"':
+			if ((p = memchr(p + 1, '"', end - p - 1)) == NULL)
+				return end;
+			break;
+
+		case '[':
+			for (++p; p != end && *p != ']' && *p != '\n'; ++p) {
+				if (*p == '\\' && ++p == end)
+					return end;
+			}
+			if (p == end)
+				return end;
+			break;
+
+		case ';':
+			if ((p = memchr(p, '\n', end - p)) == NULL)
+				return end;
+			break;
+
+		default: {
+			const size_t k = blank_span(p, end - p);
+			if (k == 0)
+				break;
+			p += k;
+			continue;
+		}
+		}
+		++p;
+	}
+
+	return end;
+}
+
+static void *
+encode_shard(void *arg)
+{
+	struct Flat *f = arg;
+	size_t n;
+
+	f->done = 0;
+	f->nlines = 0;
+	while (f->done < f->size &&
+	       (n = encode_window(f, f->src + f->done, f->size - f->done))
+	       != 0)
+		f->done += n;
+
+	return NULL;
+}
+
+static void
+encode_parallel(struct EncSt *z, struct Stream *str)
+{
+	const uint8_t * const end = str->data + str->size;
+
+	while (str->size >= 2 * SHARD_SIZE) {
+		const uint8_t *p = str->data;
+		unsigned i, n;
+		int rv;
+
+		for (n = 0; n < z->njobs && p != end; ++n) {
+			struct Flat *f = z->flat + n;
+			f->src = p;
+			p = shard_end(p, end, SHARD_SIZE);
+			f->size = p - f->src;
+		}
+
+		for (i = 1; i < n; ++i) {
+			rv = pthread_create(&z->flat[i].thread, NULL,
+					    encode_shard, z->flat + i);
+			if (rv != 0)
+				error(1, rv, "pthread_create failed");
+		}
+		encode_shard(z->flat);
+		for (i = 1; i < n; ++i)
+			pthread_join(z->flat[i].thread, NULL);
+
+		for (i = 0; i < n; ++i) {
+			struct Flat *f = z->flat + i;
+			const bool whole = f->done == f->size;
+
+			flush_flat(z, f, str);
+			if (!whole) {
+				for (++i; i < n; ++i)
+					buffer_reset(&z->flat[i].out);
+				return;
+			}
+		}
+	}
+}
+
+void
+reset_EncSt(struct EncSt *z)
+{
+	if (!list_empty(&z->bt)) {
+		/* The last frame points to the root of encoding tree */
+		release_tree(list_entry(z->bt.prev, struct Frame, h)->node, z);
+
+		while (!list_empty(&z->bt))
+			pop_frame(z);
+	}
+
+	buffer_reset(&z->acc);
+	z->state = z->comment_ret = P_ROOT;
+	z->ndigits = 0;
+	z->nibble = 0;
+	z->offset = z->bol = 0;
+	z->line = 1;
+}
+
+void
+free_EncSt(struct EncSt *z)
+{
+	if (z == NULL)
+		return;
+
+	reset_EncSt(z);
+	free(buffer_data(&z->acc));
+	free(buffer_data(&z->text));
+	free(buffer_data(&z->raw));
+	free(buffer_data(&z->record));
+	free_flats(z->flat, z->njobs);
+
+	struct list_head *p, *t;
+	list_for_each_safe(p, t, &z->spare_frames)
+		free(p);
+
+	while (z->spare_nodes != NULL) {
+		struct Node *next = z->spare_nodes->next;
+		free(z->spare_nodes);
+		z->spare_nodes = next;
+	}
+
+	free(z);
+}
+
+void
+locate_EncSt(const struct EncSt *z, unsigned long *line, unsigned long *col)
+{
+	*line = z->line;
+	*col = z->offset - z->bol + 1;
+}
+
+IterV
+encode(struct EncSt *z, struct Stream *str)
+{
+	if (str->type == S_EOF) {
+		if (z->state == P_ROOT ||
+		    (z->state == P_COMMENT && z->comment_ret == P_ROOT)) {
+			return IE_DONE;
+		} else {
+			set_error(str, "Unexpected EOF");
+			return IE_CONT;
+		}
+	}
+
+	if (z->state == P_ROOT && z->armor == NULL) {
+		if (z->njobs > 1)
+			encode_parallel(z, str);
+		encode_flat(z, str);
+	}
+
+	parse(z, str);
+	return IE_CONT;
 }
@@ -11,10 +11,22 @@
 #include "buffer.h"
 #include "list.h"
 #include "iteratee.h"
+#include "asn1.h"
+
+struct Node;
+struct Flat;
+struct Repr_Format;
 
 /* State of encoder */
 struct EncSt {
 	struct Buffer acc; /* Encoded bytes' accumulator */
+	struct Buffer text; /* Typed representation being parsed */
+	struct Buffer raw; /* Its encoding (see `universal_encoder') */
+	struct Buffer record; /* Encoded record to be written as PEM */
+	const char *armor; /* Label of PEM blocks; NULL -- write DER */
+
+	/* Format specification; an ASN.1 module gives types of tags */
+	const struct Repr_Format *repr;
 
 	/*
 	 * Backtrace -- a summary of how encoder got where it is.
@@ -23,15 +35,60 @@ struct EncSt {
 	 * and on up the stack (to the root).
 	 */
 	struct list_head bt;
+
+	int state; /* Parser's state; see `enum Parser_State' in encoder.c */
+	int comment_ret; /* State to return to at the end of comment */
+	uint32_t ndigits; /* Number of parsed digits of tag number */
+	uint8_t nibble; /* First digit of hexadecimal octet */
+
+	/* Position in input */
+	size_t offset; /* Number of bytes parsed */
+	size_t bol; /* Offset of the beginning of current line */
+	unsigned long line; /* Current line number (starting from 1) */
+
+	/* Length-first encoding of records in memory (see encoder.c) */
+	struct Flat *flat; /* One state per job */
+	unsigned njobs;
+
+	/* Unused frames and nodes, kept for reuse */
+	struct list_head spare_frames;
+	struct Node *spare_nodes; /* linked through `next' field */
 };
 
+/* Number of threads to encode large input with (see encoder.c) */
+extern unsigned encoder_jobs;
+
 /* XXX */
-void init_EncSt(struct EncSt *z);
+void init_EncSt(struct EncSt *z, const struct Repr_Format *repr,
+		unsigned flags);
+
+/*
+ * Abandon the record being encoded, if any.
+ *
+ * The accumulator is kept for reuse.
+ */
+void reset_EncSt(struct EncSt *z);
 
 /* XXX */
 void free_EncSt(struct EncSt *z);
 
+/*
+ * Get the location of the latest error (or of the byte to be parsed
+ * next): line number and column (both starting from 1).
+ */
+void locate_EncSt(const struct EncSt *z, unsigned long *line,
+		  unsigned long *col);
+
 /* XXX */
 IterV encode(struct EncSt *z, struct Stream *str);
 
+/*
+ * Append DER encoding of tag header to `dest'; `h->len' is the
+ * (definite) length of contents.
+ *
+ * Return -1 if there is not enough space in `dest', otherwise return 0.
+ */
+int encode_der_header(const struct ASN1_Header *h, struct Buffer *dest,
+		      struct Stream *str);
+
 #endif /* _ENCODER_H */
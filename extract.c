@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <ctype.h>
+
+#include "extract.h"
+#include "util.h"
+
+/*
+ * Parse tag specification -- `[uacp][0-9]+'.
+ *
+ * Return -1 if the specification is invalid, otherwise return 0.
+ */
+static int
+parse_tag(struct ASN1_Header *dest, const char *s)
+{
+	switch (*s) {
+	case 'u': dest->cls = TC_UNIVERSAL; break;
+	case 'a': dest->cls = TC_APPLICATION; break;
+	case 'c': dest->cls = TC_CONTEXT; break;
+	case 'p': dest->cls = TC_PRIVATE; break;
+	default:
+		return -1;
+	}
+
+	if (!isdigit(*++s))
+		return -1;
+
+	char *end;
+	errno = 0;
+	const unsigned long num = strtoul(s, &end, 10);
+	if (*end != '\0' || errno != 0 || num > 0x3fffffff)
+		return -1;
+
+	dest->num = num;
+	return 0;
+}
+
+/* Parse tag path -- `TAG(/TAG)*'; empty tags are not allowed */
+static int
+parse_path(struct Tag_Path *dest, const char *spec)
+{
+	dest->tags = NULL;
+	dest->len = 0;
+
+	char *s = strdup(spec);
+	if (s == NULL)
+		die("Out of memory, strdup failed");
+
+	int rv = 0;
+	char *p = s, *tok;
+	while (rv == 0 && (tok = strsep(&p, "/")) != NULL) {
+		dest->tags = xrealloc(dest->tags, (dest->len + 1) *
+				      sizeof(struct ASN1_Header));
+		rv = parse_tag(dest->tags + dest->len++, tok);
+	}
+
+	free(s);
+	return rv;
+}
+
+/* Parse range of record numbers -- `N', `N-M' or `N-' */
+static int
+parse_range(struct Range *dest, const char *s)
+{
+	char *end;
+	errno = 0;
+	dest->first = dest->last = strtoul(s, &end, 10);
+
+	if (*end == '-') {
+		if (*++end == '\0')
+			dest->last = (unsigned long) -1;
+		else if (isdigit(*end))
+			dest->last = strtoul(end, &end, 10);
+		else
+			return -1;
+	}
+
+	return (*end != '\0' || errno != 0 || dest->first == 0 ||
+		dest->last < dest->first) ? -1 : 0;
+}
+
+int
+extract_create(struct Extract *x, const char *spec)
+{
+	memset(x, 0, sizeof(*x));
+
+	char *s = strdup(spec);
+	if (s == NULL)
+		die("Out of memory, strdup failed");
+
+	int rv = 0;
+	char *saveptr, *tok;
+	for (tok = strtok_r(s, ",", &saveptr); tok != NULL && rv == 0;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (isdigit(*tok)) {
+			x->ranges = xrealloc(x->ranges, (x->nranges + 1) *
+					     sizeof(struct Range));
+			rv = parse_range(x->ranges + x->nranges++, tok);
+		} else {
+			x->paths = xrealloc(x->paths, (x->npaths + 1) *
+					    sizeof(struct Tag_Path));
+			rv = parse_path(x->paths + x->npaths++, tok);
+		}
+
+		if (rv != 0)
+			error(0, 0, "Invalid extraction specification: `%s'",
+			      tok);
+	}
+
+	if (rv == 0 && x->nranges + x->npaths == 0) {
+		error(0, 0, "Empty extraction specification");
+		rv = -1;
+	}
+
+	free(s);
+	return rv;
+}
+
+void
+extract_destroy(struct Extract *x)
+{
+	size_t i;
+	for (i = 0; i < x->npaths; ++i)
+		free(x->paths[i].tags);
+
+	free(x->paths);
+	free(x->ranges);
+	memset(x, 0, sizeof(*x));
+}
+
+/* Is record number `n' selected? */
+static bool
+selected_p(const struct Extract *x, unsigned long n)
+{
+	size_t i;
+	for (i = 0; i < x->nranges; ++i) {
+		if (x->ranges[i].first <= n && n <= x->ranges[i].last)
+			return true;
+	}
+	return false;
+}
+
+static inline bool
+tag_eq(const struct ASN1_Header *a, const struct ASN1_Header *b)
+{
+	return a->cls == b->cls && a->num == b->num;
+}
+
+/* Input file being processed */
+struct Source {
+	const char *path;
+	int fd;
+	struct Output *out;
+};
+
+/* Copy the encoding to the output */
+static int
+emit(const struct Record *rec, struct Source *src)
+{
+	if (output_next(src->out) != 0)
+		return -1;
+
+	if (copy_range(src->out->fd, src->fd, rec->offset,
+		       record_size(rec)) != 0) {
+		error(0, errno, "%s: copying failed", src->path);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Copy the encodings at the tail of tag path, descending from `rec'.
+ *
+ * @depth: number of path elements that `rec' and its ancestors match
+ */
+static int
+extract_path(const struct Tag_Path *path, size_t depth,
+	     const struct Record *rec, struct Source *src)
+{
+	if (depth == path->len)
+		return emit(rec, src);
+	else if (!rec->tag.cons_p)
+		return 0;
+
+	const off_t end = record_end(rec);
+	off_t pos;
+	struct Record child;
+	const char *errmsg;
+
+	for (pos = rec->offset + rec->hsize; pos < end;
+	     pos = record_end(&child)) {
+		if (read_record(&child, src->fd, pos, end, &errmsg) != 0) {
+			error_at_line(0, 0, src->path, pos, "%s", errmsg);
+			return -1;
+		} else if (record_end(&child) > end) {
+			error_at_line(0, 0, src->path, pos, "Tag is too big"
+				      " for its container");
+			return -1;
+		}
+
+		if (tag_eq(&child.tag, path->tags + depth) &&
+		    extract_path(path, depth + 1, &child, src) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+extract_file(const struct Extract *x, const char *inpath,
+	     struct Output *out)
+{
+	struct Records r;
+	if (records_open(&r, inpath) != 0)
+		return -1;
+
+	struct Source src = { inpath, r.fd, out };
+	int retval = 0;
+	struct Record rec;
+	unsigned long n = 0;
+
+	int found;
+	while ((found = next_record(&r, &rec)) > 0) {
+		if (selected_p(x, ++n)) {
+			retval = emit(&rec, &src);
+		} else {
+			size_t i;
+			for (i = 0; i < x->npaths && retval == 0; ++i) {
+				if (tag_eq(&rec.tag, x->paths[i].tags))
+					retval = extract_path(x->paths + i, 1,
+							      &rec, &src);
+			}
+		}
+
+		if (retval != 0)
+			goto end;
+	}
+
+	if (found < 0) {
+		error_at_line(0, 0, inpath, r.pos, "%s", r.errmsg);
+		retval = -1;
+	}
+
+end:
+	records_close(&r);
+	return retval;
+}
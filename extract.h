@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _EXTRACT_H
+#define _EXTRACT_H
+
+/*
+ * Extraction of raw DER encodings
+ *
+ * Encodings are selected by a specification -- comma-separated list
+ * of items, each being either
+ *   - a number of top-level record (counting from 1) or a range of
+ *     them: `7', `10-20', `100-';
+ *   - a tag path -- slash-separated tags (in the notation of
+ *     S-expressions), the first one being top-level: `p1', `p1/p14'.
+ *
+ * Selected encodings are copied to the output verbatim.
+ */
+
+#include <stddef.h>
+
+#include "asn1.h"
+#include "records.h"
+
+struct Extract {
+	/* Ranges of record numbers */
+	struct Range {
+		unsigned long first, last;
+	} *ranges;
+	size_t nranges;
+
+	/* Tag paths */
+	struct Tag_Path {
+		struct ASN1_Header *tags; /* `len' field is not used */
+		size_t len;
+	} *paths;
+	size_t npaths;
+};
+
+/*
+ * Parse extraction specification.
+ *
+ * Return -1 if the specification is invalid (the error is reported),
+ * otherwise return 0.
+ */
+int extract_create(struct Extract *x, const char *spec);
+
+/* Release resources allocated by `extract_create' */
+void extract_destroy(struct Extract *x);
+
+/*
+ * Copy the encodings of a file, selected by `x', to the output.
+ *
+ * Return value: 0 - success, -1 - error.
+ */
+int extract_file(const struct Extract *x, const char *inpath,
+		 struct Output *out);
+
+#endif /* _EXTRACT_H */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdbool.h>
+#include <limits.h>
+#include <zlib.h>
+
+#include "gunzip.h"
+#include "util.h"
+
+/* Producer's state */
+struct Gunzip {
+	FILE *f;
+	z_stream zs;
+
+	uint8_t *in; /* Buffer for compressed data read from `f' */
+	size_t insize; /* Capacity of `in' */
+
+	const uint8_t *mem; /* Compressed data in memory not inflated yet */
+	size_t memsize; /* Number of bytes in `mem' */
+
+	bool eof_p; /* Has the end of `f' been reached? */
+	bool member_end_p; /* Is the last gzip member complete? */
+	char *errmsg; /* Error to report after the data decompressed */
+};
+
+/*
+ * Make compressed data available for inflate().
+ *
+ * Return -1 if no more data can be read, otherwise return 0.
+ */
+static int
+refill(struct Gunzip *g)
+{
+	if (g->memsize != 0) {
+		/* `avail_in' is narrower than size_t */
+		const size_t n = MIN(g->memsize, (size_t) UINT_MAX);
+
+		g->zs.next_in = (Bytef *) g->mem;
+		g->zs.avail_in = n;
+		g->mem += n;
+		g->memsize -= n;
+		return 0;
+	}
+
+	if (g->eof_p)
+		return -1;
+
+	const size_t n = g->f == NULL ? 0 : fread(g->in, 1, g->insize, g->f);
+	if (n == 0) {
+		g->eof_p = true;
+		if (g->f != NULL && ferror(g->f))
+			xasprintf(&g->errmsg, "%s", strerror(errno));
+		else if (!g->member_end_p)
+			xasprintf(&g->errmsg, "Unexpected end of gzip data");
+		return -1;
+	}
+
+	g->zs.next_in = g->in;
+	g->zs.avail_in = n;
+	return 0;
+}
+
+static size_t
+gunzip_produce(void *arg, uint8_t *dest, size_t size, char **errmsg)
+{
+	struct Gunzip *g = arg;
+
+	g->zs.next_out = dest;
+	g->zs.avail_out = size;
+
+	while (g->zs.avail_out > 0 && g->errmsg == NULL) {
+		if (g->zs.avail_in == 0 && refill(g) < 0)
+			break;
+
+		if (g->member_end_p) {
+			/* Another gzip member follows */
+			inflateReset(&g->zs);
+			g->member_end_p = false;
+		}
+
+		const int rv = inflate(&g->zs, Z_NO_FLUSH);
+		if (rv == Z_STREAM_END) {
+			g->member_end_p = true;
+		} else if (rv != Z_OK && rv != Z_BUF_ERROR) {
+			xasprintf(&g->errmsg, "gzip: %s", g->zs.msg != NULL ?
+				  g->zs.msg : "inflate failed");
+		}
+	}
+
+	const size_t n = size - g->zs.avail_out;
+	if (n == 0 && g->errmsg != NULL) {
+		*errmsg = g->errmsg;
+		g->errmsg = NULL;
+	}
+	return n;
+}
+
+static void
+gunzip_release(void *arg)
+{
+	struct Gunzip *g = arg;
+
+	inflateEnd(&g->zs);
+	free(g->in);
+	free(g->errmsg);
+	free(g);
+}
+
+struct Pipeline *
+gunzip_start(FILE *f, const uint8_t *head, size_t n, size_t bufsize)
+{
+	struct Gunzip *g = new_zeroed(struct Gunzip);
+
+	g->f = f;
+	if (f == NULL) {
+		/* Inflate the data where they are */
+		g->mem = head;
+		g->memsize = n;
+	} else {
+		g->insize = MAX(bufsize, n);
+		g->in = xmalloc(g->insize);
+		memcpy(g->in, head, n);
+
+		g->zs.next_in = g->in;
+		g->zs.avail_in = n;
+	}
+
+	/* 16 + MAX_WBITS: expect gzip header and trailer */
+	if (inflateInit2(&g->zs, 16 + MAX_WBITS) != Z_OK)
+		die("inflateInit2 failed: %s",
+		    g->zs.msg != NULL ? g->zs.msg : "out of memory");
+
+	/*
+	 * Double buffering: one chunk is decoded while the other is filled.
+	 * Reading `f' can block, so the producer is cancellable.
+	 */
+	return pipeline_start(gunzip_produce, gunzip_release, g, bufsize, 2,
+			      f != NULL);
+}
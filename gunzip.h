@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _GUNZIP_H
+#define _GUNZIP_H
+
+#include <stdio.h>
+
+#include "pipeline.h"
+
+/* Do the data start with gzip magic number? */
+static inline int
+gzip_magic_p(const uint8_t *p, size_t n)
+{
+	return n >= 2 && p[0] == 0x1f && p[1] == 0x8b;
+}
+
+/*
+ * Start decompressing gzip data in a separate thread.
+ *
+ * @f: compressed file (the caller remains its owner); NULL if all
+ *     data are in `head'
+ * @head: data already read from `f'; if `f' is NULL, the data are
+ *     not copied and should stay in place till `pipeline_stop'
+ * @n: size of `head'
+ * @bufsize: size of chunks of decompressed data
+ *
+ * Concatenated gzip members are decompressed as a single stream, like
+ * gzip(1) does.  Chunks of decompressed data are obtained with
+ * `pipeline_next'; `pipeline_stop' finishes decompression.
+ */
+struct Pipeline *gunzip_start(FILE *f, const uint8_t *head, size_t n,
+			      size_t bufsize);
+
+#endif /* _GUNZIP_H */
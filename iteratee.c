@@ -7,20 +7,29 @@
  */
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 #include "iteratee.h"
 
+char out_of_memory[] = "Out of memory";
+
 void
 set_error(struct Stream *str, const char *format, ...)
 {
 	if (str->errmsg != NULL)
 		return;
 
-	va_list ap;
+	va_list ap, aq;
 	va_start(ap, format);
+	va_copy(aq, ap);
 
-	xasprintf(&str->errmsg, format, ap);
+	const int n = vsnprintf(NULL, 0, format, ap);
+	if (n < 0 || (str->errmsg = malloc(n + 1)) == NULL)
+		str->errmsg = out_of_memory;
+	else
+		vsnprintf(str->errmsg, n + 1, format, aq);
 
+	va_end(aq);
 	va_end(ap);
 }
 
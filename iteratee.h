@@ -27,6 +27,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "util.h"
 
@@ -79,11 +80,22 @@ struct Stream {
  * Do nothing if `str->errmsg' is not NULL, thus keeping the original
  * error message.
  *
- * NOTE: This function calls malloc(3). Be sure to free(3)
- * `str->errmsg' eventually.
+ * NOTE: This function calls malloc(3). Be sure to release
+ * `str->errmsg' with `free_errmsg' eventually.  If memory allocation
+ * fails, `str->errmsg' is set to `out_of_memory'.
  */
 void set_error(struct Stream *str, const char *format, ...);
 
+/* Error message that is not malloc'ed (see `set_error') */
+extern char out_of_memory[];
+
+/* Release error message */
+static inline void free_errmsg(char *msg)
+{
+	if (msg != out_of_memory)
+		free(msg);
+}
+
 /* -- Some primitive iteratees -------------------------------------- */
 
 /*
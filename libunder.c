@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <assert.h>
+
+#include "libunder.h"
+#include "decoder.h"
+#include "codec.h"
+#include "repr.h"
+
+struct Under_Decoder {
+	struct DecSt *z;
+	struct Stream str; /* Stream the decoder is fed with */
+
+	/* Handlers of the caller, called from `cb' */
+	const struct Under_Callbacks *user;
+	void *user_ctx;
+	struct Walk_Callbacks cb;
+};
+
+/* Format specification with no tags' representations */
+static const struct Repr_Format no_format = {
+	NULL, HLIST_HEAD_INIT, NULL, NULL, HLIST_HEAD_INIT, NULL
+};
+
+void
+export_header(struct under_header *dest, const struct ASN1_Header *src)
+{
+	static const enum under_tag_class classes[] = {
+		[TC_UNIVERSAL] = UNDER_TC_UNIVERSAL,
+		[TC_APPLICATION] = UNDER_TC_APPLICATION,
+		[TC_CONTEXT] = UNDER_TC_CONTEXT,
+		[TC_PRIVATE] = UNDER_TC_PRIVATE
+	};
+
+	dest->cls = classes[src->cls];
+	dest->num = src->num;
+	dest->cons_p = src->cons_p;
+	dest->len = src->len;
+	dest->indef_p = src->indef_p;
+}
+
+/*
+ * Handlers of `walk' that pass the events on to the caller's ones
+ */
+
+static int
+on_header(void *ctx, const struct ASN1_Header *tag, uint32_t depth)
+{
+	const struct Under_Decoder *d = ctx;
+	struct under_header h;
+
+	export_header(&h, tag);
+	return d->user->header(d->user_ctx, &h, depth);
+}
+
+static int
+on_primitive(void *ctx, const uint8_t *data, size_t n, bool final)
+{
+	const struct Under_Decoder *d = ctx;
+	return d->user->primitive(d->user_ctx, data, n, final);
+}
+
+static int
+on_end(void *ctx, uint32_t depth)
+{
+	const struct Under_Decoder *d = ctx;
+	return d->user->end(d->user_ctx, depth);
+}
+
+struct Under_Decoder *
+under_decoder_new(const struct Under_Callbacks *cb, void *ctx, unsigned flags)
+{
+	struct Under_Decoder *d = malloc(sizeof(struct Under_Decoder));
+	if (d == NULL)
+		return NULL;
+
+	if ((d->z = malloc(sizeof(struct DecSt))) == NULL) {
+		free(d);
+		return NULL;
+	}
+
+	/* Missing handlers stay NULL: `walk' takes shortcuts then */
+	d->user = cb;
+	d->user_ctx = ctx;
+	d->cb.header = cb != NULL && cb->header != NULL ? on_header : NULL;
+	d->cb.primitive = cb != NULL && cb->primitive != NULL ?
+		on_primitive : NULL;
+	d->cb.end = cb != NULL && cb->end != NULL ? on_end : NULL;
+
+	init_DecSt(d->z, &no_format, flags & UNDER_STRICT ? CF_STRICT : 0);
+	d->z->cb = &d->cb;
+	d->z->cb_ctx = d;
+
+	d->str = (struct Stream) STREAM_INIT;
+	d->str.type = S_CHUNK;
+	return d;
+}
+
+void
+under_decoder_free(struct Under_Decoder *d)
+{
+	if (d == NULL)
+		return;
+
+	free_DecSt(d->z);
+	free_errmsg(d->str.errmsg);
+	free(d);
+}
+
+int
+under_feed(struct Under_Decoder *d, const void *buf, size_t n)
+{
+	if (d->str.errmsg != NULL || d->str.type == S_EOF)
+		return -1;
+
+	d->str.data = buf;
+	d->str.size = n;
+
+	const IterV indic = walk(d->z, &d->str);
+	assert(indic == IE_CONT);
+
+	return d->str.errmsg == NULL ? 0 : -1;
+}
+
+int
+under_finish(struct Under_Decoder *d)
+{
+	if (d->str.errmsg != NULL)
+		return -1;
+
+	d->str.type = S_EOF;
+	d->str.size = 0;
+
+	return walk(d->z, &d->str) == IE_DONE ? 0 : -1;
+}
+
+const char *
+under_error(const struct Under_Decoder *d)
+{
+	return d->str.errmsg;
+}
@@ -0,0 +1,215 @@
+/*
+ * libunder.h -- embeddable DER decoder
+ *
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _LIBUNDER_H
+#define _LIBUNDER_H
+
+/*
+ * Push API
+ *
+ * The caller feeds DER data to the decoder in chunks of arbitrary size
+ * (see `under_feed'); the decoder calls back as soon as a tag header,
+ * a piece of primitive contents or the end of a constructed encoding
+ * is met.  No data are copied or buffered by the decoder.
+ *
+ * Example:
+ *
+ *     struct Under_Decoder *d = under_decoder_new(&cb, ctx, 0);
+ *     while ((n = read(fd, buf, sizeof(buf))) > 0)
+ *             if (under_feed(d, buf, n) != 0)
+ *                     break;
+ *     if (n != 0 || under_finish(d) != 0)
+ *             fprintf(stderr, "%s\n", under_error(d));
+ *     under_decoder_free(d);
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Only `under_*' symbols are exported by the shared library */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#  define UNDER_API __attribute__((visibility("default")))
+#else
+#  define UNDER_API
+#endif
+
+enum under_tag_class {
+	UNDER_TC_UNIVERSAL,
+	UNDER_TC_APPLICATION,
+	UNDER_TC_CONTEXT,
+	UNDER_TC_PRIVATE
+};
+
+/*
+ * Attributes of ASN.1 tag.
+ *
+ * These values are encoded in tag's identifier and length octets.
+ */
+struct under_header {
+	enum under_tag_class cls; /* Tag class */
+	uint32_t num; /* Tag number */
+	bool cons_p; /* Is encoding constructed? */
+	size_t len; /* Length of contents (0 if the length is indefinite) */
+	bool indef_p; /* Is the length indefinite?  BER only [X.690, 8.1.3.6] */
+};
+
+/*
+ * Handlers of decoding events.
+ *
+ * @ctx: the argument passed to `under_decoder_new'
+ * @depth: depth of the tag within tag hierarchy (0 for top-level tags)
+ *
+ * Any handler can be NULL.  A handler returns non-zero value to stop
+ * decoding; the decoder is in error state then.
+ */
+struct Under_Callbacks {
+	/* Tag header has been parsed */
+	int (*header)(void *ctx, const struct under_header *tag,
+		      uint32_t depth);
+
+	/*
+	 * A piece of primitive contents is available.
+	 *
+	 * @data: pointer into the chunk passed to `under_feed'
+	 * @n: number of bytes
+	 * @final: is this the last piece of contents?
+	 */
+	int (*primitive)(void *ctx, const uint8_t *data, size_t n,
+			 bool final);
+
+	/* Constructed encoding of depth `depth' has ended */
+	int (*end)(void *ctx, uint32_t depth);
+};
+
+/* Options of the decoder (bit flags) */
+enum {
+	/* Reject BER encodings that are not valid DER */
+	UNDER_STRICT = 1 << 0
+};
+
+/* Decoder instance (opaque) */
+struct Under_Decoder;
+
+/*
+ * Create a decoder.
+ *
+ * Return NULL if memory allocation failed.  The library never exits
+ * the process: running out of memory while decoding is reported by
+ * `under_feed' as any other error.
+ */
+UNDER_API struct Under_Decoder *
+under_decoder_new(const struct Under_Callbacks *cb, void *ctx, unsigned flags);
+
+/* Release resources allocated for the decoder */
+UNDER_API void under_decoder_free(struct Under_Decoder *d);
+
+/*
+ * Decode another chunk of data.
+ *
+ * Return -1 if an error occurred (see `under_error'), otherwise 0.
+ */
+UNDER_API int under_feed(struct Under_Decoder *d, const void *buf, size_t n);
+
+/*
+ * Signal the end of data.
+ *
+ * Return -1 if data end in the middle of a record or an error occurred
+ * earlier, otherwise return 0.
+ */
+UNDER_API int under_finish(struct Under_Decoder *d);
+
+/* Error message; NULL if there were no errors */
+UNDER_API const char *under_error(const struct Under_Decoder *d);
+
+/*
+ * Pull API
+ *
+ * A cursor walks DER data that reside in memory entirely (e.g., a
+ * mmap(2)ped file), returning pointers into the original buffer.
+ * Cursor functions do not allocate memory.
+ *
+ * Example:
+ *
+ *     struct Under_Cursor c;
+ *     under_cursor_init(&c, buf, size);
+ *     while ((rv = under_next(&c)) > 0) {
+ *             if (under_tag(&c)->cons_p)
+ *                     under_enter(&c);  (next tags are the children)
+ *             ...
+ *     }
+ *     if (rv < 0)
+ *             fprintf(stderr, "%s\n", c.errmsg);
+ */
+
+/* Maximal depth of tag hierarchy that a cursor can descend to */
+#define UNDER_MAX_DEPTH 32
+
+struct Under_Cursor {
+	struct under_header tag; /* Attributes of current tag */
+	const uint8_t *value; /* Contents of current tag; NULL if none */
+
+	const uint8_t *next; /* Start of the next tag */
+	const uint8_t *end; /* End of current container */
+
+	uint32_t depth; /* Current depth within tag hierarchy */
+	const uint8_t *ends[UNDER_MAX_DEPTH]; /* Ends of outer containers */
+
+	const char *errmsg; /* Error message; NULL if there were no errors */
+};
+
+/* Position the cursor before the first top-level tag of `buf' */
+UNDER_API void under_cursor_init(struct Under_Cursor *c, const void *buf,
+				 size_t n);
+
+/*
+ * Advance to the next tag within current container, skipping the
+ * contents of current tag.
+ *
+ * Return 1 if the cursor points to a tag, 0 if the end of container is
+ * reached, -1 if an error occurred (see `c->errmsg').
+ */
+UNDER_API int under_next(struct Under_Cursor *c);
+
+/*
+ * Descend into the constructed encoding of current tag; the following
+ * `under_next' moves the cursor to the first child.
+ *
+ * Return -1 if current tag is not constructed or is too deep,
+ * otherwise return 0.
+ */
+UNDER_API int under_enter(struct Under_Cursor *c);
+
+/*
+ * Skip the rest of current container and ascend to its level; the
+ * following `under_next' moves the cursor to the container's next
+ * sibling.
+ *
+ * Return -1 at the top level, otherwise return 0.
+ */
+UNDER_API int under_skip(struct Under_Cursor *c);
+
+/* Attributes of the tag the cursor points to */
+static inline const struct under_header *
+under_tag(const struct Under_Cursor *c)
+{
+	return &c->tag;
+}
+
+/*
+ * Contents of the tag the cursor points to; the number of bytes is
+ * `under_tag(c)->len'.
+ */
+static inline const uint8_t *
+under_value(const struct Under_Cursor *c)
+{
+	return c->value;
+}
+
+#endif /* _LIBUNDER_H */
@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "oid.h"
+#include "universal.h"
+#include "buffer.h"
+#include "util.h"
+
+/* Entry of the dictionary */
+struct Entry {
+	char *name;
+	uint32_t enc; /* Offset of the encoding in `Dict.bytes' */
+	uint32_t size; /* Size of the encoding */
+	unsigned long ln; /* Line number of the entry */
+};
+
+/*
+ * Node of radix trie over encodings of OIDs.
+ *
+ * Children of a node occupy consecutive elements of `Dict.nodes',
+ * sorted by the first byte of their labels.
+ */
+struct Node {
+	uint32_t label; /* Offset of the edge label in `Dict.bytes' */
+	uint32_t len; /* Length of the label */
+	uint32_t kids; /* Index of the first child */
+	uint32_t nkids; /* Number of children */
+	const char *name; /* Name of the OID spelled by the path (or NULL) */
+	uint8_t first; /* The first byte of the label */
+};
+
+static struct Dict {
+	struct Buffer bytes; /* Encodings of OIDs */
+
+	struct Entry *entries; /* Sorted by name, once loaded */
+	size_t n; /* Number of entries */
+	size_t cap; /* Capacity of `entries' array */
+
+	struct Node *nodes; /* The root comes first; NULL if not loaded */
+	uint32_t nnodes;
+} dict;
+
+/* Common OIDs of X.509 certificates [RFC 5280, RFC 3279, RFC 4055, ...] */
+static const char builtin[] =
+	"2.5.4.3 commonName\n"
+	"2.5.4.4 surname\n"
+	"2.5.4.5 serialNumber\n"
+	"2.5.4.6 countryName\n"
+	"2.5.4.7 localityName\n"
+	"2.5.4.8 stateOrProvinceName\n"
+	"2.5.4.9 streetAddress\n"
+	"2.5.4.10 organizationName\n"
+	"2.5.4.11 organizationalUnitName\n"
+	"2.5.4.12 title\n"
+	"2.5.4.15 businessCategory\n"
+	"2.5.4.17 postalCode\n"
+	"2.5.4.42 givenName\n"
+	"2.5.4.97 organizationIdentifier\n"
+	"0.9.2342.19200300.100.1.25 domainComponent\n"
+	"1.2.840.113549.1.9.1 emailAddress\n"
+	"1.3.6.1.4.1.311.60.2.1.2 jurisdictionStateOrProvinceName\n"
+	"1.3.6.1.4.1.311.60.2.1.3 jurisdictionCountryName\n"
+
+	"2.5.29.14 subjectKeyIdentifier\n"
+	"2.5.29.15 keyUsage\n"
+	"2.5.29.17 subjectAltName\n"
+	"2.5.29.18 issuerAltName\n"
+	"2.5.29.19 basicConstraints\n"
+	"2.5.29.20 cRLNumber\n"
+	"2.5.29.21 reasonCode\n"
+	"2.5.29.30 nameConstraints\n"
+	"2.5.29.31 cRLDistributionPoints\n"
+	"2.5.29.32 certificatePolicies\n"
+	"2.5.29.32.0 anyPolicy\n"
+	"2.5.29.33 policyMappings\n"
+	"2.5.29.35 authorityKeyIdentifier\n"
+	"2.5.29.36 policyConstraints\n"
+	"2.5.29.37 extKeyUsage\n"
+	"1.3.6.1.5.5.7.1.1 authorityInfoAccess\n"
+	"1.3.6.1.5.5.7.2.1 cps\n"
+	"1.3.6.1.5.5.7.2.2 unotice\n"
+	"1.3.6.1.5.5.7.3.1 serverAuth\n"
+	"1.3.6.1.5.5.7.3.2 clientAuth\n"
+	"1.3.6.1.5.5.7.3.3 codeSigning\n"
+	"1.3.6.1.5.5.7.3.4 emailProtection\n"
+	"1.3.6.1.5.5.7.3.8 timeStamping\n"
+	"1.3.6.1.5.5.7.3.9 OCSPSigning\n"
+	"1.3.6.1.5.5.7.48.1 ocsp\n"
+	"1.3.6.1.5.5.7.48.2 caIssuers\n"
+	"1.3.6.1.4.1.11129.2.4.2 signedCertificateTimestampList\n"
+	"1.3.6.1.4.1.11129.2.4.3 precertificatePoison\n"
+	"2.16.840.1.113730.1.1 netscapeCertType\n"
+	"2.23.140.1.1 extendedValidation\n"
+	"2.23.140.1.2.1 domainValidated\n"
+	"2.23.140.1.2.2 organizationValidated\n"
+	"2.23.140.1.2.3 individualValidated\n"
+
+	"1.2.840.113549.1.1.1 rsaEncryption\n"
+	"1.2.840.113549.1.1.4 md5WithRSAEncryption\n"
+	"1.2.840.113549.1.1.5 sha1WithRSAEncryption\n"
+	"1.2.840.113549.1.1.10 rsassaPss\n"
+	"1.2.840.113549.1.1.11 sha256WithRSAEncryption\n"
+	"1.2.840.113549.1.1.12 sha384WithRSAEncryption\n"
+	"1.2.840.113549.1.1.13 sha512WithRSAEncryption\n"
+	"1.2.840.10040.4.1 dsa\n"
+	"1.2.840.10040.4.3 dsaWithSha1\n"
+	"1.2.840.10045.2.1 ecPublicKey\n"
+	"1.2.840.10045.3.1.7 prime256v1\n"
+	"1.3.132.0.34 secp384r1\n"
+	"1.3.132.0.35 secp521r1\n"
+	"1.2.840.10045.4.1 ecdsaWithSHA1\n"
+	"1.2.840.10045.4.3.2 ecdsaWithSHA256\n"
+	"1.2.840.10045.4.3.3 ecdsaWithSHA384\n"
+	"1.2.840.10045.4.3.4 ecdsaWithSHA512\n"
+	"1.3.101.110 X25519\n"
+	"1.3.101.112 Ed25519\n"
+	"1.3.14.3.2.26 sha1\n"
+	"2.16.840.1.101.3.4.2.1 sha256\n"
+	"2.16.840.1.101.3.4.2.2 sha384\n"
+	"2.16.840.1.101.3.4.2.3 sha512\n"
+
+	"1.2.840.113549.1.7.1 data\n"
+	"1.2.840.113549.1.7.2 signedData\n"
+	"1.2.840.113549.1.9.3 contentType\n"
+	"1.2.840.113549.1.9.4 messageDigest\n"
+	"1.2.840.113549.1.9.5 signingTime\n"
+	"1.2.840.113549.1.9.14 extensionRequest\n";
+
+/*
+ * Parse an entry of the dictionary (`line' is `n' bytes long).
+ * Return 0 on success, -1 on error.
+ */
+static int
+add_entry(const char *line, size_t n, const char *path, unsigned long ln,
+	  struct Buffer *tmp)
+{
+	const char *p = line;
+	const char * const end = line + n;
+
+	while (p != end && isspace((unsigned char) *p))
+		++p;
+	if (p == end || *p == '#')
+		return 0; /* empty line */
+
+	const char *arcs = p;
+	while (p != end && (isdigit((unsigned char) *p) || *p == '.'))
+		++p;
+	const size_t arcs_len = p - arcs;
+
+	const char *s = p;
+	while (p != end && isspace((unsigned char) *p))
+		++p;
+
+	const char *name = p;
+	if (p != end && isalpha((unsigned char) *p))
+		for (++p; p != end && (isalnum((unsigned char) *p) ||
+				       *p == '-' || *p == '_'); ++p)
+			;
+	const size_t name_len = p - name;
+
+	while (p != end && isspace((unsigned char) *p))
+		++p;
+
+	if (arcs_len == 0 || s == name || name_len == 0 ||
+	    (p != end && *p != '#')) {
+		fprintf(stderr, "%s:%lu: Syntax error\n", path, ln);
+		return -1;
+	}
+
+	buffer_reset(tmp);
+	if (universal_encoder(UT_OBJECT_IDENTIFIER)(tmp, (const uint8_t *) arcs,
+						    arcs_len) != 0) {
+		fprintf(stderr, "%s:%lu: %s\n", path, ln, buffer_data(tmp));
+		return -1;
+	}
+
+	if (dict.n == dict.cap) {
+		dict.cap = dict.cap == 0 ? 64 : 2 * dict.cap;
+		dict.entries = realloc(dict.entries,
+				       dict.cap * sizeof(struct Entry));
+		if (dict.entries == NULL)
+			die("Out of memory, realloc failed");
+	}
+
+	struct Entry *e = dict.entries + dict.n++;
+	xasprintf(&e->name, "%.*s", (int) name_len, name);
+	e->enc = buffer_len(&dict.bytes);
+	e->size = buffer_len(tmp);
+	e->ln = ln;
+
+	if (buffer_reserve(&dict.bytes, e->size) != 0)
+		die("Out of memory, buffer_reserve failed");
+	buffer_put(&dict.bytes, buffer_data(tmp), e->size);
+	return 0;
+}
+
+static inline const uint8_t *
+encoding(const struct Entry *e)
+{
+	return buffer_data(&dict.bytes) + e->enc;
+}
+
+/* Order of encodings; a prefix goes before the strings it starts */
+static int
+cmp_encodings(const void *a, const void *b)
+{
+	const struct Entry *x = a, *y = b;
+	const int r = memcmp(encoding(x), encoding(y), MIN(x->size, y->size));
+
+	return r != 0 ? r : (int) x->size - (int) y->size;
+}
+
+static int
+cmp_names(const void *a, const void *b)
+{
+	return strcmp(((const struct Entry *) a)->name,
+		      ((const struct Entry *) b)->name);
+}
+
+/*
+ * Build the subtrie of `node' from entries [lo, hi), which share
+ * the first `depth' bytes of encoding.
+ */
+static void
+build(struct Node *node, size_t lo, size_t hi, size_t depth)
+{
+	const struct Entry * const e = dict.entries;
+
+	if (lo < hi && e[lo].size == depth)
+		node->name = e[lo++].name;
+
+	size_t i, j;
+	node->nkids = 0;
+	for (i = lo; i < hi; i = j) {
+		for (j = i + 1; j < hi &&
+			     encoding(e + j)[depth] == encoding(e + i)[depth];
+		     ++j)
+			;
+		++node->nkids;
+	}
+
+	node->kids = dict.nnodes;
+	dict.nnodes += node->nkids;
+
+	struct Node *kid = dict.nodes + node->kids;
+	for (i = lo; i < hi; i = j, ++kid) {
+		const uint8_t *first = encoding(e + i);
+
+		for (j = i + 1; j < hi && encoding(e + j)[depth] == first[depth];
+		     ++j)
+			;
+
+		/* Common prefix of the group is that of its first and last */
+		const uint8_t *last = encoding(e + j - 1);
+		size_t len = depth + 1;
+		while (len < e[i].size && len < e[j - 1].size &&
+		       first[len] == last[len])
+			++len;
+
+		kid->label = e[i].enc + depth;
+		kid->len = len - depth;
+		kid->first = first[depth];
+		kid->name = NULL;
+		build(kid, i, j, len);
+	}
+}
+
+/* Report the later of two entries with the same OID or name */
+static void
+duplicate(const char *path, const char *what, const struct Entry *a,
+	  const struct Entry *b)
+{
+	const struct Entry *first = a->ln < b->ln ? a : b;
+	const struct Entry *dup = a->ln < b->ln ? b : a;
+
+	fprintf(stderr, "%s:%lu: Duplicate %s `%s' (see line %lu, `%s')\n",
+		path, dup->ln, what, dup->name, first->ln, first->name);
+}
+
+static int
+finish_load(const char *path)
+{
+	size_t i;
+
+	qsort(dict.entries, dict.n, sizeof(struct Entry), cmp_encodings);
+	for (i = 1; i < dict.n; ++i) {
+		if (cmp_encodings(dict.entries + i - 1, dict.entries + i) == 0) {
+			duplicate(path, "OID", dict.entries + i - 1,
+				  dict.entries + i);
+			return -1;
+		}
+	}
+
+	/* A radix trie of n strings has at most 2n nodes, root included */
+	dict.nodes = xmalloc((2 * dict.n + 1) * sizeof(struct Node));
+	memset(dict.nodes, 0, sizeof(struct Node));
+	dict.nnodes = 1;
+	build(dict.nodes, 0, dict.n, 0);
+	assert(dict.nnodes <= 2 * dict.n + 1);
+
+	/* Nodes point to names, which stay in place */
+	qsort(dict.entries, dict.n, sizeof(struct Entry), cmp_names);
+	for (i = 1; i < dict.n; ++i) {
+		if (streq(dict.entries[i - 1].name, dict.entries[i].name)) {
+			duplicate(path, "name", dict.entries + i - 1,
+				  dict.entries + i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int
+oid_dict_load(const char *path)
+{
+	assert(dict.nodes == NULL && dict.n == 0);
+
+	BUFFER(tmp);
+	unsigned long ln = 1;
+	int rv = 0;
+
+	if (path == NULL) {
+		path = "(compiled-in OIDs)";
+
+		const char *p, *eol;
+		for (p = builtin; rv == 0 && *p != 0; p = eol + 1, ++ln) {
+			eol = strchr(p, '\n');
+			rv = add_entry(p, eol - p, path, ln, &tmp);
+		}
+	} else {
+		FILE *f = fopen(path, "r");
+		if (f == NULL) {
+			error(0, errno, "%s", path);
+			return -1;
+		}
+
+		char *line = NULL;
+		size_t sz = 0;
+		ssize_t n;
+
+		while (rv == 0 && (n = getline(&line, &sz, f)) >= 0)
+			rv = add_entry(line, n, path, ln++, &tmp);
+
+		free(line);
+		fclose(f);
+	}
+
+	free(buffer_data(&tmp));
+
+	if (rv == 0)
+		rv = finish_load(path);
+	if (rv != 0)
+		oid_dict_destroy();
+	return rv;
+}
+
+void
+oid_dict_destroy(void)
+{
+	size_t i;
+	for (i = 0; i < dict.n; ++i)
+		free(dict.entries[i].name);
+
+	free(dict.entries);
+	free(dict.nodes);
+	free(buffer_data(&dict.bytes));
+
+	memset(&dict, 0, sizeof(dict));
+}
+
+const char *
+oid_name(const uint8_t *src, size_t n)
+{
+	if (dict.nodes == NULL)
+		return NULL;
+
+	const uint8_t * const bytes = buffer_data(&dict.bytes);
+	const struct Node *node = dict.nodes;
+
+	while (n != 0) {
+		const struct Node *kid = dict.nodes + node->kids;
+		uint32_t lo = 0, hi = node->nkids;
+
+		while (lo < hi) {
+			const uint32_t mid = (lo + hi) / 2;
+			if (kid[mid].first < *src)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (lo == node->nkids || kid[lo].first != *src)
+			return NULL;
+
+		node = kid + lo;
+		if (node->len > n ||
+		    memcmp(bytes + node->label, src, node->len) != 0)
+			return NULL;
+
+		src += node->len;
+		n -= node->len;
+	}
+
+	return node->name;
+}
+
+int
+oid_by_name(const char *name, size_t n, const uint8_t **enc, size_t *size)
+{
+	size_t lo = 0, hi = dict.n;
+
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2;
+		const char *s = dict.entries[mid].name;
+
+		int r = strncmp(s, name, n);
+		if (r == 0)
+			r = s[n] == 0 ? 0 : 1;
+
+		if (r == 0) {
+			*enc = encoding(dict.entries + mid);
+			*size = dict.entries[mid].size;
+			return 0;
+		} else if (r < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return -1;
+}
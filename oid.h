@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _OID_H
+#define _OID_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Dictionary of OBJECT IDENTIFIER names.
+ *
+ * Typed representation of OBJECT IDENTIFIER (see universal.h) is its
+ * name, if the dictionary has one.  Names are looked up by DER
+ * encoding of OID contents, with no conversion to dotted form.
+ */
+
+/*
+ * Load the dictionary -- an `ARCS NAME' entry per line, e.g.
+ *
+ *   2.5.4.3  commonName  # comment
+ *
+ * NULL `path' loads the compiled-in dictionary (common X.509 OIDs).
+ *
+ * Return 0 on success; otherwise print error message and return -1.
+ */
+int oid_dict_load(const char *path);
+
+/* Free the dictionary */
+void oid_dict_destroy(void);
+
+/*
+ * Find the name of OID, given contents octets of its encoding.
+ * Return NULL if the name is unknown (or no dictionary is loaded).
+ */
+const char *oid_name(const uint8_t *src, size_t n);
+
+/*
+ * Find the OID named `name' (`n' bytes long).  Set `*enc' and `*size'
+ * to its contents octets and return 0; return -1 if the name is
+ * unknown.
+ */
+int oid_by_name(const char *name, size_t n, const uint8_t **enc,
+		size_t *size);
+
+#endif /* _OID_H */
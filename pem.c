@@ -0,0 +1,431 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+#include "pem.h"
+#include "util.h"
+
+const char *pem_label = "CERTIFICATE";
+
+/* Marker lines longer than this are not recognized */
+#define PEM_LINE 80
+
+/* States of PEM decoder */
+enum Pem_State {
+	PEM_TEXT, /* outside of blocks */
+	PEM_BODY, /* base64 data */
+	PEM_PAD, /* padding at the end of base64 data */
+	PEM_END /* "-----END ..." line */
+};
+
+/* State of PEM decoder */
+struct Pem {
+	enum Pem_State state;
+	bool bol_p; /* Is it the beginning of line? */
+	unsigned long lineno; /* Current line number (starting from 1) */
+
+	char line[PEM_LINE]; /* Marker line being read */
+	size_t linelen; /* Its length (may exceed PEM_LINE) */
+	char label[PEM_LINE]; /* Label of the current block */
+	size_t labellen;
+
+	uint32_t quantum; /* Sextets of incomplete base64 quantum */
+	unsigned nsextets; /* Number of sextets in `quantum' */
+	unsigned npad; /* Number of padding characters seen */
+
+	uint8_t *out; /* Decoded bytes */
+	size_t outsize; /* Capacity of `out' */
+};
+
+/* Amount of text before the first block that is looked through */
+#define PEM_TEXT_MAX (64 * 1024)
+
+int
+pem_magic_p(const uint8_t *p, size_t n)
+{
+	static const char magic[] = "-----BEGIN ";
+	const uint8_t *const end = p + MIN(n, PEM_TEXT_MAX);
+
+	while (p < end) {
+		const size_t k = MIN((size_t) (end - p), sizeof(magic) - 1);
+		if (k >= 5 && memcmp(p, magic, k) == 0)
+			return 1;
+
+		/* Skip a line of explanatory text */
+		for (; p < end && *p != '\n'; ++p) {
+			if (!isprint(*p) && !isspace(*p))
+				return 0;
+		}
+		++p;
+	}
+	return 0;
+}
+
+struct Pem *
+pem_new(void)
+{
+	struct Pem *pem = new_zeroed(struct Pem);
+	pem->bol_p = true;
+	pem->lineno = 1;
+	return pem;
+}
+
+void
+pem_free(struct Pem *pem)
+{
+	if (pem == NULL)
+		return;
+
+	free(pem->out);
+	free(pem);
+}
+
+/* Value of base64 character; -1 if `c' is not one */
+static inline int
+sextet(uint8_t c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	else if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	else if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	else if (c == '+')
+		return 62;
+	else if (c == '/')
+		return 63;
+	else
+		return -1;
+}
+
+/*
+ * Decode 16 base64 characters into 12 bytes.
+ *
+ * Return false (storing nothing) unless all the characters belong to
+ * base64 alphabet; such blocks are left to the byte-wise decoder.
+ */
+#ifdef __SSE2__
+static inline bool
+decode16(const uint8_t *src, uint8_t *dest)
+{
+#  define IN_RANGE(c, lo, hi)						\
+	_mm_and_si128(_mm_cmpgt_epi8((c), _mm_set1_epi8((lo) - 1)),	\
+		      _mm_cmplt_epi8((c), _mm_set1_epi8((hi) + 1)))
+
+	const __m128i c = _mm_loadu_si128((const __m128i *) src);
+	const __m128i upper = IN_RANGE(c, 'A', 'Z');
+	const __m128i lower = IN_RANGE(c, 'a', 'z');
+	const __m128i digit = IN_RANGE(c, '0', '9');
+	const __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+	const __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+#  undef IN_RANGE
+
+	const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower),
+					   _mm_or_si128(_mm_or_si128(digit, plus),
+							slash));
+	if (_mm_movemask_epi8(valid) != 0xffff)
+		return false;
+
+	/* Character -> sextet */
+	const __m128i shift = _mm_or_si128(
+		_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+			     _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+		_mm_or_si128(_mm_or_si128(
+				     _mm_and_si128(digit,
+						   _mm_set1_epi8(52 - '0')),
+				     _mm_and_si128(plus,
+						   _mm_set1_epi8(62 - '+'))),
+			     _mm_and_si128(slash, _mm_set1_epi8(63 - '/'))));
+	const __m128i v = _mm_add_epi8(c, shift);
+
+	/* Pairs of sextets -> 12-bit words -> 24-bit groups */
+	const __m128i w = _mm_or_si128(
+		_mm_and_si128(_mm_slli_epi16(v, 6), _mm_set1_epi16(0x0fc0)),
+		_mm_srli_epi16(v, 8));
+	const __m128i t = _mm_or_si128(
+		_mm_and_si128(_mm_slli_epi32(w, 12),
+			      _mm_set1_epi32(0x00fff000)),
+		_mm_srli_epi32(w, 16));
+
+	uint32_t g[4];
+	_mm_storeu_si128((__m128i *) g, t);
+
+	int i;
+	for (i = 0; i < 4; ++i, dest += 3) {
+		dest[0] = g[i] >> 16;
+		dest[1] = g[i] >> 8;
+		dest[2] = g[i];
+	}
+	return true;
+}
+#else
+static inline bool
+decode16(const uint8_t *src, uint8_t *dest)
+{
+	uint32_t g[4];
+	int i;
+	for (i = 0; i < 16; ++i) {
+		const int v = sextet(src[i]);
+		if (v < 0)
+			return false;
+		g[i / 4] = g[i / 4] << 6 | v;
+	}
+
+	for (i = 0; i < 4; ++i, dest += 3) {
+		dest[0] = g[i] >> 16;
+		dest[1] = g[i] >> 8;
+		dest[2] = g[i];
+	}
+	return true;
+}
+#endif
+
+static inline void
+line_putc(struct Pem *pem, char c)
+{
+	if (pem->linelen < PEM_LINE)
+		pem->line[pem->linelen] = c;
+	++pem->linelen;
+}
+
+/* Does the marker line have the form "-----<word> LABEL-----"? */
+static bool
+marker_p(const struct Pem *pem, const char *word, const char **label,
+	 size_t *labellen)
+{
+	const size_t n = strlen(word);
+
+	if (pem->linelen > PEM_LINE || pem->linelen < n + 10 ||
+	    memcmp(pem->line, "-----", 5) != 0 ||
+	    memcmp(pem->line + 5, word, n) != 0 ||
+	    pem->line[5 + n] != ' ' ||
+	    memcmp(pem->line + pem->linelen - 5, "-----", 5) != 0)
+		return false;
+
+	*label = pem->line + n + 6;
+	*labellen = pem->linelen - n - 11;
+	return true;
+}
+
+/* Process the end of line; return -1 on error */
+static int
+end_of_line(struct Pem *pem, char **errmsg)
+{
+	const char *label;
+	size_t n;
+
+	switch (pem->state) {
+	case PEM_TEXT:
+		if (marker_p(pem, "BEGIN", &label, &n)) {
+			memcpy(pem->label, label, n);
+			pem->labellen = n;
+			pem->state = PEM_BODY;
+			pem->nsextets = pem->npad = 0;
+		}
+		break;
+
+	case PEM_END:
+		if (!marker_p(pem, "END", &label, &n) ||
+		    n != pem->labellen || memcmp(label, pem->label, n) != 0) {
+			xasprintf(errmsg, "PEM line %lu: `-----END %.*s-----'"
+				  " expected", pem->lineno,
+				  (int) pem->labellen, pem->label);
+			return -1;
+		}
+		pem->state = PEM_TEXT;
+		break;
+
+	default:
+		break;
+	}
+
+	pem->linelen = 0;
+	pem->bol_p = true;
+	++pem->lineno;
+	return 0;
+}
+
+/* Start reading "-----END" line; return -1 if base64 data are incomplete */
+static int
+start_end_line(struct Pem *pem, char **errmsg)
+{
+	if ((pem->state == PEM_BODY && pem->nsextets != 0) ||
+	    (pem->state == PEM_PAD && pem->nsextets + pem->npad != 4)) {
+		xasprintf(errmsg, "PEM line %lu: Truncated base64 data",
+			  pem->lineno);
+		return -1;
+	}
+
+	pem->state = PEM_END;
+	return 0;
+}
+
+/* Report unexpected byte of base64 data */
+static size_t
+invalid(const struct Pem *pem, uint8_t c, char **errmsg)
+{
+	if (isgraph(c))
+		xasprintf(errmsg, "PEM line %lu: Unexpected character `%c'",
+			  pem->lineno, c);
+	else
+		xasprintf(errmsg, "PEM line %lu: Unexpected byte 0x%02x",
+			  pem->lineno, c);
+	return 0;
+}
+
+size_t
+pem_decode(struct Pem *pem, const uint8_t *src, size_t n,
+	   const uint8_t **out, char **errmsg)
+{
+	/* Every 4 characters give at most 3 bytes */
+	const size_t maxsize = n / 4 * 3 + 3;
+	if (pem->outsize < maxsize) {
+		free(pem->out);
+		pem->out = xmalloc(maxsize);
+		pem->outsize = maxsize;
+	}
+
+	const uint8_t *p = src;
+	const uint8_t *const end = src + n;
+	uint8_t *o = pem->out;
+
+	while (p < end) {
+		if (pem->state == PEM_BODY && pem->nsextets == 0) {
+			/* Fast path: whole lines of base64 characters */
+			const uint8_t *const start = p;
+			for (; end - p >= 16 && decode16(p, o); p += 16)
+				o += 12;
+
+			if (p != start)
+				pem->bol_p = false;
+			if (p == end)
+				break;
+		}
+
+		const uint8_t c = *p++;
+		if (c == '\n') {
+			if (end_of_line(pem, errmsg) != 0)
+				return 0;
+			continue;
+		} else if (c == '\r') {
+			continue;
+		}
+
+		const bool bol_p = pem->bol_p;
+		pem->bol_p = false;
+
+		switch (pem->state) {
+		case PEM_TEXT:
+		case PEM_END:
+			line_putc(pem, c);
+			break;
+
+		case PEM_BODY:
+		case PEM_PAD:
+			if (c == ' ' || c == '\t')
+				break;
+
+			if (bol_p && c == '-') {
+				if (start_end_line(pem, errmsg) != 0)
+					return 0;
+				line_putc(pem, c);
+				break;
+			}
+
+			if (c == '=') {
+				if (pem->nsextets < 2 ||
+				    pem->nsextets + ++pem->npad > 4)
+					return invalid(pem, c, errmsg);
+
+				if (pem->state == PEM_PAD)
+					break;
+				pem->state = PEM_PAD;
+
+				if (pem->nsextets == 2) {
+					*o++ = pem->quantum >> 4;
+				} else {
+					*o++ = pem->quantum >> 10;
+					*o++ = pem->quantum >> 2;
+				}
+				break;
+			}
+
+			const int v = sextet(c);
+			if (v < 0 || pem->state == PEM_PAD)
+				return invalid(pem, c, errmsg);
+
+			pem->quantum = pem->quantum << 6 | v;
+			if (++pem->nsextets == 4) {
+				*o++ = pem->quantum >> 16;
+				*o++ = pem->quantum >> 8;
+				*o++ = pem->quantum;
+				pem->nsextets = 0;
+			}
+			break;
+		}
+	}
+
+	*out = pem->out;
+	return o - pem->out;
+}
+
+int
+pem_finish(struct Pem *pem, char **errmsg)
+{
+	/* The last line may lack newline character */
+	if (pem->linelen != 0 && end_of_line(pem, errmsg) != 0)
+		return -1;
+
+	if (pem->state != PEM_TEXT) {
+		xasprintf(errmsg, "PEM line %lu: `-----END %.*s-----'"
+			  " expected", pem->lineno, (int) pem->labellen,
+			  pem->label);
+		return -1;
+	}
+	return 0;
+}
+
+void
+pem_write(FILE *f, const char *label, const uint8_t *src, size_t n)
+{
+	static const char alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+		"0123456789+/";
+	char line[65];
+	size_t len = 0;
+
+	fprintf(f, "-----BEGIN %s-----\n", label);
+
+	for (; n != 0; src += 3, n -= MIN(n, 3)) {
+		const uint32_t g = src[0] << 16 |
+			(n > 1 ? src[1] << 8 : 0) | (n > 2 ? src[2] : 0);
+
+		line[len++] = alphabet[g >> 18];
+		line[len++] = alphabet[g >> 12 & 0x3f];
+		line[len++] = n > 1 ? alphabet[g >> 6 & 0x3f] : '=';
+		line[len++] = n > 2 ? alphabet[g & 0x3f] : '=';
+
+		if (len == 64) {
+			line[len++] = '\n';
+			fwrite(line, len, 1, f);
+			len = 0;
+		}
+	}
+
+	if (len != 0) {
+		line[len++] = '\n';
+		fwrite(line, len, 1, f);
+	}
+	fprintf(f, "-----END %s-----\n", label);
+}
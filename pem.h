@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _PEM_H
+#define _PEM_H
+
+/*
+ * PEM -- textual encoding of DER data [RFC 7468]:
+ *
+ *   -----BEGIN CERTIFICATE-----
+ *   MIIBszCCAVmgAwIBAgIUQ2/c...   (base64, 64 characters per line)
+ *   -----END CERTIFICATE-----
+ *
+ * Concatenated blocks (e.g., certificate bundles) are decoded as a
+ * single stream of DER records.  Text between blocks is ignored.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Do the data look like PEM -- lines of text, followed by "-----BEGIN"?
+ * Only "-----" is checked if fewer bytes of the marker are available.
+ */
+int pem_magic_p(const uint8_t *p, size_t n);
+
+struct Pem;
+
+/* Allocate the state of PEM decoder */
+struct Pem *pem_new(void);
+
+/* Free the state of PEM decoder */
+void pem_free(struct Pem *pem);
+
+/*
+ * Decode another chunk of PEM data.
+ *
+ * Return the number of DER bytes, storing their address in `*out';
+ * the bytes stay valid till the next call.  Zero is returned if the
+ * chunk has no complete DER bytes or an error occurs; in the latter
+ * case `*errmsg' is set to malloc'ed error message.
+ */
+size_t pem_decode(struct Pem *pem, const uint8_t *src, size_t n,
+		  const uint8_t **out, char **errmsg);
+
+/*
+ * Check that PEM data have not ended prematurely.
+ *
+ * Return 0 on success; otherwise set `*errmsg' and return -1.
+ */
+int pem_finish(struct Pem *pem, char **errmsg);
+
+/* Label of PEM blocks written by encoder */
+extern const char *pem_label;
+
+/* Write DER data as a PEM block */
+void pem_write(FILE *f, const char *label, const uint8_t *src, size_t n);
+
+#endif /* _PEM_H */
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "util.h"
+
+/* Element of the ring */
+struct Slot {
+	uint8_t *data;
+	size_t size; /* Number of bytes stored; 0 means end of data */
+	char *errmsg; /* Error message of the producer (if any) */
+};
+
+struct Pipeline {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled; /* A slot has been filled by the producer */
+	pthread_cond_t freed; /* A slot has been given back by the consumer */
+
+	Produce_Fn produce;
+	void (*release)(void *);
+	void *arg; /* Producer's state */
+
+	struct Slot *ring;
+	unsigned nbufs; /* Number of slots */
+	size_t bufsize; /* Capacity of each slot */
+
+	unsigned head; /* Next slot to be filled */
+	unsigned tail; /* Next slot to be consumed */
+	unsigned count; /* Number of filled slots */
+
+	bool cancel_p; /* Can `produce' be cancelled? */
+	bool held_p; /* Is the consumer holding `ring[tail]'? */
+	bool stop_p; /* Should the producer stop? */
+	bool eof_p; /* Has the consumer got the end of data? */
+};
+
+static void *
+producer(void *arg)
+{
+	struct Pipeline *p = arg;
+
+	/* Only `produce' can be cancelled, never a wait on `lock' */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		while (p->count == p->nbufs && !p->stop_p)
+			pthread_cond_wait(&p->freed, &p->lock);
+
+		if (p->stop_p) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		struct Slot *s = p->ring + p->head;
+		pthread_mutex_unlock(&p->lock);
+
+		/* Fill the slot, while the consumer is busy with others */
+		s->errmsg = NULL;
+		if (p->cancel_p)
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		s->size = p->produce(p->arg, s->data, p->bufsize, &s->errmsg);
+		if (p->cancel_p)
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		debug_print("producer: %lu bytes", (unsigned long) s->size);
+
+		pthread_mutex_lock(&p->lock);
+		p->head = (p->head + 1) % p->nbufs;
+		++p->count;
+		pthread_cond_signal(&p->filled);
+		pthread_mutex_unlock(&p->lock);
+
+		if (s->size == 0)
+			break; /* end of data */
+	}
+
+	return NULL;
+}
+
+struct Pipeline *
+pipeline_start(Produce_Fn produce, void (*release)(void *), void *arg,
+	       size_t bufsize, unsigned nbufs, bool cancel_p)
+{
+	struct Pipeline *p = new_zeroed(struct Pipeline);
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->filled, NULL);
+	pthread_cond_init(&p->freed, NULL);
+
+	p->produce = produce;
+	p->release = release;
+	p->arg = arg;
+	p->cancel_p = cancel_p;
+
+	p->nbufs = MAX(nbufs, 2);
+	p->bufsize = bufsize;
+	p->ring = xmalloc(p->nbufs * sizeof(struct Slot));
+
+	unsigned i;
+	for (i = 0; i < p->nbufs; ++i) {
+		p->ring[i].data = xmalloc(bufsize);
+		p->ring[i].errmsg = NULL;
+	}
+
+	const int rv = pthread_create(&p->thread, NULL, producer, p);
+	if (rv != 0)
+		error(1, rv, "pthread_create failed");
+
+	return p;
+}
+
+size_t
+pipeline_next(struct Pipeline *p, const uint8_t **data, char **errmsg)
+{
+	if (p->eof_p)
+		return 0;
+
+	pthread_mutex_lock(&p->lock);
+	if (p->held_p) {
+		p->tail = (p->tail + 1) % p->nbufs;
+		--p->count;
+		p->held_p = false;
+		pthread_cond_signal(&p->freed);
+	}
+
+	while (p->count == 0)
+		pthread_cond_wait(&p->filled, &p->lock);
+
+	struct Slot *s = p->ring + p->tail;
+	p->held_p = true;
+	pthread_mutex_unlock(&p->lock);
+
+	if (s->size == 0) {
+		p->eof_p = true;
+
+		if (s->errmsg != NULL && *errmsg == NULL) {
+			*errmsg = s->errmsg;
+			s->errmsg = NULL;
+		}
+	}
+
+	*data = s->data;
+	return s->size;
+}
+
+void
+pipeline_stop(struct Pipeline *p)
+{
+	if (p == NULL)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	p->stop_p = true;
+	pthread_cond_signal(&p->freed);
+	pthread_mutex_unlock(&p->lock);
+
+	/* The producer may be blocked reading data that never come */
+	if (p->cancel_p)
+		pthread_cancel(p->thread);
+	pthread_join(p->thread, NULL);
+
+	if (p->release != NULL)
+		p->release(p->arg);
+
+	unsigned i;
+	for (i = 0; i < p->nbufs; ++i) {
+		free(p->ring[i].data);
+		free(p->ring[i].errmsg);
+	}
+	free(p->ring);
+
+	pthread_cond_destroy(&p->freed);
+	pthread_cond_destroy(&p->filled);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+/* State of read-ahead producer */
+struct Reader {
+	FILE *f;
+	const uint8_t *head; /* Data to be passed before reading `f' */
+	size_t n; /* Size of `head' */
+};
+
+static size_t
+read_produce(void *arg, uint8_t *dest, size_t size, char **errmsg)
+{
+	struct Reader *r = arg;
+
+	if (r->n != 0) {
+		const size_t n = MIN(r->n, size);
+		memcpy(dest, r->head, n);
+		r->head += n;
+		r->n -= n;
+		return n;
+	}
+
+	const size_t n = fread(dest, 1, size, r->f);
+	if (n == 0 && ferror(r->f))
+		xasprintf(errmsg, "%s", strerror(errno));
+	return n;
+}
+
+struct Pipeline *
+readahead_start(FILE *f, const uint8_t *head, size_t n, size_t bufsize,
+		unsigned nbufs)
+{
+	struct Reader *r = xmalloc(sizeof(struct Reader));
+
+	r->f = f;
+	r->head = head;
+	r->n = n;
+
+	return pipeline_start(read_produce, free, r, bufsize, nbufs, true);
+}
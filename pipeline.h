@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+/*
+ * Pipeline -- a ring of buffers, filled with data by a separate
+ * (producer) thread and consumed, one chunk at a time, by the
+ * enumerator.  Producing the next chunks (reading, decompressing)
+ * overlaps with decoding of the current one.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Type of function that fills a buffer with data; it is called by
+ * the producer thread.
+ *
+ * @arg: producer's state
+ * @dest: buffer to fill
+ * @size: capacity of the buffer
+ * @errmsg: where to put (malloc'ed) error message
+ *
+ * Return the number of bytes stored.  Zero is returned if the end of
+ * data is reached or an error occurs.
+ */
+typedef size_t (*Produce_Fn)(void *arg, uint8_t *dest, size_t size,
+			     char **errmsg);
+
+struct Pipeline;
+
+/*
+ * Start producer thread.
+ *
+ * @produce: function that fills buffers
+ * @release: function that frees producer's state `arg' (can be NULL)
+ * @bufsize: size of each buffer
+ * @nbufs: number of buffers in the ring (2 or more)
+ * @cancel_p: may `produce' be cancelled by `pipeline_stop'?  This is
+ *     for producers that can block indefinitely (e.g. reading a pipe)
+ *     and hold no resources across cancellation points.
+ */
+struct Pipeline *pipeline_start(Produce_Fn produce, void (*release)(void *),
+				void *arg, size_t bufsize, unsigned nbufs,
+				bool cancel_p);
+
+/*
+ * Wait for the next chunk of data.  The chunk, returned by previous
+ * call, is given back to the producer.
+ *
+ * Return the size of chunk, storing its address in `*data'.  Zero is
+ * returned if the end of data is reached or an error occurred; in the
+ * latter case `*errmsg' is set (unless it is not NULL already).
+ */
+size_t pipeline_next(struct Pipeline *p, const uint8_t **data,
+		     char **errmsg);
+
+/*
+ * Stop producer thread and release resources.  The producer is
+ * cancelled if it was started with `cancel_p' set, so that reading
+ * input nobody waits for does not delay stopping.
+ */
+void pipeline_stop(struct Pipeline *p);
+
+/*
+ * Start reading a file ahead in a separate thread.
+ *
+ * @f: file to read (the caller remains its owner)
+ * @head: data already read from `f'; they start the first chunk
+ * @n: size of `head'
+ * @bufsize, @nbufs: see `pipeline_start'
+ */
+struct Pipeline *readahead_start(FILE *f, const uint8_t *head, size_t n,
+				 size_t bufsize, unsigned nbufs);
+
+#endif /* _PIPELINE_H */
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "prefetch.h"
+#include "util.h"
+
+/* Producer's state */
+struct Files {
+	char *const *paths;
+	size_t npaths;
+	size_t next; /* Index of the file to read next */
+};
+
+/* Read the whole file unless it is too large or not regular */
+static void
+load_file(const char *path, struct Loaded *ld)
+{
+	ld->data = NULL;
+	ld->size = 0;
+	ld->errnum = 0;
+
+	if (streq(path, "-"))
+		return;
+
+	/*
+	 * FIFOs, terminals and devices are not opened: opening or closing
+	 * them has side effects.  They are left to the enumerator.
+	 */
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		ld->errnum = errno;
+		return;
+	} else if (!S_ISREG(st.st_mode) || st.st_size > PREFETCH_MAX_SIZE) {
+		return;
+	}
+
+	const int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+	if (fd < 0) {
+		ld->errnum = errno;
+		return;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		ld->errnum = errno;
+	} else if (S_ISREG(st.st_mode) && st.st_size <= PREFETCH_MAX_SIZE) {
+		ld->data = xmalloc(MAX(st.st_size, 1));
+
+		while (ld->size < (size_t) st.st_size) {
+			const ssize_t n = read(fd, ld->data + ld->size,
+					       st.st_size - ld->size);
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n < 0) {
+				ld->errnum = errno;
+				free(ld->data);
+				ld->data = NULL;
+				break;
+			} else if (n == 0) {
+				break; /* the file has shrunk */
+			}
+			ld->size += n;
+		}
+	}
+
+	close(fd);
+}
+
+static size_t
+prefetch_produce(void *arg, uint8_t *dest, size_t size,
+		 char **errmsg __attribute__((unused)))
+{
+	struct Files *fs = arg;
+
+	if (fs->next == fs->npaths)
+		return 0;
+
+	load_file(fs->paths[fs->next++], (struct Loaded *) dest);
+	return size;
+}
+
+struct Pipeline *
+prefetch_start(char *const *paths, size_t npaths)
+{
+	struct Files *fs = xmalloc(sizeof(struct Files));
+
+	fs->paths = paths;
+	fs->npaths = npaths;
+	fs->next = 0;
+
+	return pipeline_start(prefetch_produce, free, fs,
+			      sizeof(struct Loaded), PREFETCH_DEPTH, false);
+}
+
+int
+prefetch_next(struct Pipeline *p, struct Loaded *ld)
+{
+	const uint8_t *data;
+	char *errmsg = NULL;
+
+	if (pipeline_next(p, &data, &errmsg) == 0)
+		return -1;
+
+	memcpy(ld, data, sizeof(struct Loaded));
+	return 0;
+}
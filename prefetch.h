@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+/*
+ * Prefetching of small files
+ *
+ * When many input files are given, a separate thread opens and reads
+ * the files following the one being decoded, so that system calls do
+ * not alternate with decoding.
+ */
+
+#include "pipeline.h"
+
+/* Files larger than this are not prefetched */
+#define PREFETCH_MAX_SIZE (256 * 1024)
+
+/* Maximal number of files read in advance */
+#define PREFETCH_DEPTH 32
+
+/* Contents of a file, read in advance */
+struct Loaded {
+	uint8_t *data; /* NULL if the file has not been read */
+	size_t size;
+	int errnum; /* errno value if the file could not be read */
+};
+
+/*
+ * Start reading files in a separate thread.
+ *
+ * Standard input ("-"), files that are not regular and files larger
+ * than PREFETCH_MAX_SIZE are not read.
+ */
+struct Pipeline *prefetch_start(char *const *paths, size_t npaths);
+
+/*
+ * Get the contents of the next file, in the order of `paths'.
+ * The caller is responsible for freeing `ld->data'.
+ *
+ * Return -1 if there are no more files, otherwise return 0.
+ */
+int prefetch_next(struct Pipeline *p, struct Loaded *ld);
+
+#endif /* _PREFETCH_H */
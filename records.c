@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "records.h"
+#include "decoder.h"
+#include "util.h"
+
+/* Maximal size of tag header that `parse_header' accepts */
+#define HEADER_MAX 16
+
+int
+read_record(struct Record *rec, int fd, off_t pos, off_t end,
+	    const char **errmsg)
+{
+	uint8_t buf[HEADER_MAX];
+	const ssize_t n = pread(fd, buf, MIN(end - pos, (off_t) HEADER_MAX), pos);
+
+	if (n < 0) {
+		*errmsg = strerror(errno);
+		return -1;
+	}
+
+	const int rv = parse_header(&rec->tag, buf, n);
+	if (rv == 0) {
+		*errmsg = "Unexpected EOF";
+		return -1;
+	} else if (rv < 0) {
+		*errmsg = "Invalid tag header";
+		return -1;
+	}
+
+	rec->offset = pos;
+	rec->hsize = rv;
+	return 0;
+}
+
+int
+records_open(struct Records *r, const char *path)
+{
+	struct stat st;
+
+	if (streq(path, "-")) {
+		r->fd = STDIN_FILENO;
+	} else if ((r->fd = open(path, O_RDONLY)) < 0) {
+		error(0, errno, "%s", path);
+		return -1;
+	}
+
+	if (fstat(r->fd, &st) != 0) {
+		error(0, errno, "%s", path);
+	} else if (!S_ISREG(st.st_mode)) {
+		error(0, 0, "%s: Not a regular file", path);
+	} else {
+		r->pos = 0;
+		r->end = st.st_size;
+		r->nfill = 0;
+		r->errmsg = NULL;
+		return 0;
+	}
+
+	records_close(r);
+	return -1;
+}
+
+void
+records_close(struct Records *r)
+{
+	if (r->fd != STDIN_FILENO)
+		close(r->fd);
+	r->fd = -1;
+}
+
+#ifdef FILLERS
+/*
+ * Skip filler bytes, starting at `r->pos'.
+ *
+ * Return -1 if an error occurred, otherwise return 0.
+ */
+static int
+skip_fillers(struct Records *r)
+{
+	uint8_t buf[64 * 1024];
+
+	while (r->pos < r->end) {
+		const ssize_t n = pread(r->fd, buf,
+					MIN(r->end - r->pos, (off_t) sizeof(buf)),
+					r->pos);
+		if (n <= 0) {
+			r->errmsg = n < 0 ? strerror(errno) : "Unexpected EOF";
+			return -1;
+		}
+
+		const size_t k = filler_span(buf, n);
+		r->pos += k;
+		r->nfill += k;
+
+		if (k < (size_t) n)
+			break;
+	}
+
+	return 0;
+}
+#endif
+
+int
+next_record(struct Records *r, struct Record *rec)
+{
+	r->nfill = 0;
+
+#ifdef FILLERS
+	if (skip_fillers(r) != 0)
+		return -1;
+#endif
+
+	if (r->pos == r->end)
+		return 0;
+
+	if (read_record(rec, r->fd, r->pos, r->end, &r->errmsg) != 0)
+		return -1;
+
+	if (rec->tag.len > (size_t) (r->end - r->pos) - rec->hsize) {
+		r->errmsg = "Unexpected EOF";
+		return -1;
+	}
+
+	r->pos = record_end(rec);
+	return 1;
+}
+
+/* Copy data through user space; the last resort of `copy_range' */
+static ssize_t
+copy_rw(int out, int in, off_t *offset, off_t n)
+{
+	static uint8_t buf[64 * 1024];
+
+	const ssize_t k = pread(in, buf, MIN(n, (off_t) sizeof(buf)),
+				*offset);
+	if (k <= 0)
+		return k;
+
+	ssize_t i;
+	for (i = 0; i < k; ) {
+		const ssize_t rv = write(out, buf + i, k - i);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0)
+			return -1;
+		i += rv;
+	}
+
+	*offset += k;
+	return k;
+}
+
+/* Is it worth trying another copying method after this error? */
+static inline bool
+fallback_p(int errnum)
+{
+	return errnum == EXDEV || errnum == EINVAL || errnum == ENOSYS ||
+		errnum == EOPNOTSUPP || errnum == EBADF || errnum == ETXTBSY;
+}
+
+int
+copy_range(int out, int in, off_t offset, off_t n)
+{
+	while (n > 0) {
+		/* In-kernel copy; may share extents on CoW file systems */
+		ssize_t k = copy_file_range(in, &offset, out, NULL, n, 0);
+
+		/* Output is a pipe, socket or a file on another device */
+		if (k < 0 && fallback_p(errno))
+			k = sendfile(out, in, &offset, n);
+
+		if (k < 0 && fallback_p(errno))
+			k = copy_rw(out, in, &offset, n);
+
+		if (k < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		} else if (k == 0) {
+			errno = EIO; /* the file has shrunk */
+			return -1;
+		}
+
+		n -= k;
+	}
+
+	return 0;
+}
+
+int
+output_next(struct Output *out)
+{
+	if (out->prefix == NULL) {
+		out->fd = STDOUT_FILENO;
+		return 0;
+	}
+
+	if (output_close(out) != 0)
+		return -1;
+
+	char *path = NULL;
+	xasprintf(&path, "%s%04lu", out->prefix, ++out->count);
+
+	out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out->fd < 0)
+		error(0, errno, "%s", path);
+
+	free(path);
+	return out->fd < 0 ? -1 : 0;
+}
+
+int
+output_close(struct Output *out)
+{
+	if (out->fd < 0 || out->fd == STDOUT_FILENO)
+		return 0;
+
+	const int rv = close(out->fd);
+	if (rv != 0)
+		error(0, errno, "%s%04lu", out->prefix, out->count);
+
+	out->fd = -1;
+	return rv;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _RECORDS_H
+#define _RECORDS_H
+
+/*
+ * Record-level access to DER files
+ *
+ * Top-level records (and tags within them) are located by reading
+ * tag headers only; contents are never read.  Byte ranges found are
+ * copied from file to file by the kernel (see `copy_range').
+ */
+
+#include <sys/types.h>
+
+#include "asn1.h"
+
+/* Encoding of a tag within a file */
+struct Record {
+	off_t offset; /* Position of tag header */
+	size_t hsize; /* Size of tag header */
+	struct ASN1_Header tag; /* Tag attributes */
+};
+
+/* Size of the whole encoding (header and contents) */
+static inline off_t
+record_size(const struct Record *rec)
+{
+	return rec->hsize + rec->tag.len;
+}
+
+/* Position right after the encoding */
+static inline off_t
+record_end(const struct Record *rec)
+{
+	return rec->offset + record_size(rec);
+}
+
+/*
+ * Read tag header at `pos'; the header should end before `end'.
+ * The caller is responsible for checking that the contents fit in.
+ *
+ * Return -1 if an error occurred (see `*errmsg'), otherwise return 0.
+ */
+int read_record(struct Record *rec, int fd, off_t pos, off_t end,
+		const char **errmsg);
+
+/* Iterator over top-level records of a file */
+struct Records {
+	int fd;
+	off_t pos; /* Position of the next record */
+	off_t end; /* Size of file */
+	off_t nfill; /* Number of filler bytes before the latest record */
+	const char *errmsg; /* Error message; NULL if there were no errors */
+};
+
+/*
+ * Open a file (or standard input, if `path' is "-") for iteration.
+ *
+ * Return -1 if an error occurred (the error is reported), otherwise
+ * return 0.
+ */
+int records_open(struct Records *r, const char *path);
+
+/* Close the file opened by `records_open' */
+void records_close(struct Records *r);
+
+/*
+ * Find the next top-level record.  Filler bytes (see FILLERS) between
+ * the records are skipped.
+ *
+ * Return 1 if a record is found, 0 if the end of file is reached,
+ * -1 if an error occurred (see `r->errmsg').
+ */
+int next_record(struct Records *r, struct Record *rec);
+
+/*
+ * Copy `n' bytes at `offset' of file `in' to the current position of
+ * `out', avoiding copying of data to user space when possible.
+ *
+ * Return -1 if an error occurred (see errno), otherwise return 0.
+ */
+int copy_range(int out, int in, off_t offset, off_t n);
+
+/*
+ * Destination of copied data -- standard output or a sequence of
+ * files, named PREFIX0001, PREFIX0002, etc.
+ */
+struct Output {
+	const char *prefix; /* NULL for standard output */
+	unsigned long count; /* Number of files created */
+	int fd; /* Current output file; -1 if none */
+};
+
+#define OUTPUT_INIT(prefix) { prefix, 0, -1 }
+
+/*
+ * Start another output file; do nothing if the output is standard
+ * output.
+ *
+ * Return -1 if an error occurred (the error is reported), otherwise
+ * return 0.
+ */
+int output_next(struct Output *out);
+
+/*
+ * Close current output file.
+ *
+ * Return -1 if an error occurred (the error is reported), otherwise
+ * return 0.
+ */
+int output_close(struct Output *out);
+
+#endif /* _RECORDS_H */
@@ -13,6 +13,7 @@
 #include <dlfcn.h>
 
 #include "repr.h"
+#include "schema.h"
 #include "hash.h"
 #include "util.h"
 
@@ -28,6 +29,24 @@ struct Repr {
 	/* Converters: */
 	Repr_Codec decode; /* Raw bytes to human-friendly representation */
 	/* Repr_Codec encode; /\* Representation to raw bytes *\/ */
+
+	/* Representations of child tags (ASN.1 module only) */
+	const struct Repr_Table *children;
+
+	/* Universal type of primitive contents (ASN.1 module only; 0 if none) */
+	uint32_t utag;
+};
+
+/*
+ * Table of representations -- a hash table with open addressing,
+ * keyed by `Repr.key'.
+ */
+struct Repr_Table {
+	struct Repr_Table *next; /* Next table of the module */
+
+	const struct Repr **slots;
+	uint32_t nbits; /* Number of slots is 2^nbits */
+	size_t n; /* Number of representations */
 };
 
 struct Plugin {
@@ -52,11 +71,25 @@ repr_destroy(struct Repr_Format *fmt)
 	}
 	fmt->libs.first = NULL;
 
+	struct Repr *r;
+	hlist_for_each_entry_safe(r, x, tmp, &fmt->nodes, _node) {
+		free(r->name);
+		free(r);
+	}
+	fmt->nodes.first = NULL;
+
+	while (fmt->tables != NULL) {
+		struct Repr_Table *next = fmt->tables->next;
+		free(fmt->tables->slots);
+		free(fmt->tables);
+		fmt->tables = next;
+	}
+	fmt->top = NULL;
+
 	if (fmt->dict == NULL)
 		return;
 
 	const size_t nbuckets = 1 << HASH_NBITS;
-	struct Repr *r;
 
 	size_t i;
 	for (i = 0; i < nbuckets; ++i) {
@@ -69,6 +102,7 @@ repr_destroy(struct Repr_Format *fmt)
 
 	free(fmt->dict);
 	fmt->dict = NULL;
+	fmt->root = NULL;
 }
 
 static struct hlist_head *
@@ -120,8 +154,13 @@ find_plugin(struct hlist_head *libs, const char *name)
 	return lib;
 }
 
+/*
+ * Look up `symbol' in the plugin.  Unless `quiet' is true, warn if
+ * the plugin or the symbol is missing.
+ */
 static void *
-find_symbol(struct hlist_head *libs, const char *plugin, const char *symbol)
+find_symbol(struct hlist_head *libs, const char *plugin, const char *symbol,
+	    bool quiet)
 {
 	debug_print("find_symbol: %s.%s", plugin, symbol);
 
@@ -134,7 +173,9 @@ find_symbol(struct hlist_head *libs, const char *plugin, const char *symbol)
 		       < sizeof(filename));
 
                 if ((lib->handle = dlopen(filename, RTLD_LAZY)) == NULL) {
-                        fprintf(stderr, "*WARNING* %s\n", dlerror());
+			const char *err = dlerror();
+			if (!quiet)
+				fprintf(stderr, "*WARNING* %s\n", err);
 			lib->handle = NOLIB_HANDLE;
                         return NULL;
                 }
@@ -149,16 +190,11 @@ find_symbol(struct hlist_head *libs, const char *plugin, const char *symbol)
         if (err == NULL)
 		return sym;
 
-	fprintf(stderr, "*WARNING* %s\n", err);
+	if (!quiet)
+		fprintf(stderr, "*WARNING* %s\n", err);
         return NULL;
 }
 
-static inline uint32_t
-tagkey(enum Tag_Class cls, uint32_t num)
-{
-        return cls << 30 | num;
-}
-
 static uint32_t
 tagspec2key(const char *s)
 {
@@ -195,6 +231,24 @@ bucket_getitem(const struct hlist_head *bucket, uint32_t key)
         return NULL;
 }
 
+/*
+ * Find decoder of `codec' type in the plugin (the default one if
+ * `plugin' is NULL).  See `find_symbol'.
+ */
+static Repr_Codec
+find_decoder(struct hlist_head *libs, const char *plugin, const char *codec,
+	     bool quiet)
+{
+	const bool defplug_p = plugin == NULL ||
+		streq(plugin, hlist_entry(libs->first, struct Plugin,
+					  _node)->name);
+	char s[64] = {0};
+
+	return find_symbol(libs, defplug_p ? NULL : plugin,
+			   strncat(strncpy(s, "decode_", sizeof(s)-1),
+				   codec, sizeof(s) - strlen(s) - 1), quiet);
+}
+
 static int
 add_repr(struct Repr_Format *fmt, const char *tag, const char *name,
 	 const char *plugin, const char *codec, const char *conf_path)
@@ -222,23 +276,122 @@ add_repr(struct Repr_Format *fmt, const char *tag, const char *name,
 	xasprintf(&r->name, "%s", name);
 
 	if (codec != NULL) {
-		const bool defplug_p = plugin == NULL ||
-			streq(plugin, hlist_entry(fmt->libs.first,
-						  struct Plugin, _node)->name);
-		char s[64] = {0};
-
-		r->decode = find_symbol
-			(&fmt->libs, defplug_p ? NULL : plugin,
-			 strncat(strncpy(s, "decode_", sizeof(s)-1),
-				 codec, sizeof(s) - strlen(s) - 1));
-
+		r->decode = find_decoder(&fmt->libs, plugin, codec, false);
 		/* XXX r->encode */
 	}
 
 	hlist_add_head(&r->_node, head);
+	if (fmt->root == NULL)
+		fmt->root = r;
 	return 0;
 }
 
+struct Repr *
+repr_new(struct Repr_Format *fmt, uint32_t key, const char *name,
+	 const char *codec)
+{
+	struct Repr *r = new_zeroed(struct Repr);
+
+	r->key = key;
+	if (name != NULL)
+		xasprintf(&r->name, "%s", name);
+	if (codec != NULL) /* not every type of the module has a decoder */
+		r->decode = find_decoder(&fmt->libs, NULL, codec, true);
+
+	hlist_add_head(&r->_node, &fmt->nodes);
+	return r;
+}
+
+void
+repr_set_children(struct Repr *r, const struct Repr_Table *t)
+{
+	r->children = t;
+}
+
+void
+repr_set_utag(struct Repr *r, uint32_t utag)
+{
+	r->utag = utag;
+}
+
+struct Repr_Table *
+repr_table_new(struct Repr_Format *fmt)
+{
+	struct Repr_Table *t = new_zeroed(struct Repr_Table);
+
+	t->nbits = 2;
+	t->slots = xmalloc(sizeof(*t->slots) << t->nbits);
+	memset(t->slots, 0, sizeof(*t->slots) << t->nbits);
+
+	t->next = fmt->tables;
+	fmt->tables = t;
+	return t;
+}
+
+/* Return the slot of `key' -- either occupied by it or empty one */
+static inline const struct Repr **
+table_slot(const struct Repr_Table *t, uint32_t key)
+{
+	const uint32_t mask = (1U << t->nbits) - 1;
+	uint32_t i = hash_32(key, t->nbits);
+
+	while (t->slots[i] != NULL && t->slots[i]->key != key)
+		i = (i + 1) & mask;
+
+	return t->slots + i;
+}
+
+const struct Repr *
+repr_table_put(struct Repr_Table *t, const struct Repr *r)
+{
+	const struct Repr **slot = table_slot(t, r->key);
+	const struct Repr *old = *slot;
+
+	if (old != NULL) {
+		*slot = r;
+		return old;
+	}
+
+	if (2 * (t->n + 1) > 1U << t->nbits) { /* keep load factor <= 1/2 */
+		const struct Repr **old_slots = t->slots;
+		const size_t nslots = 1U << t->nbits;
+
+		++t->nbits;
+		t->slots = xmalloc(sizeof(*t->slots) << t->nbits);
+		memset(t->slots, 0, sizeof(*t->slots) << t->nbits);
+
+		size_t i;
+		for (i = 0; i < nslots; ++i)
+			if (old_slots[i] != NULL)
+				*table_slot(t, old_slots[i]->key) = old_slots[i];
+		free(old_slots);
+	}
+
+	*table_slot(t, r->key) = r;
+	++t->n;
+	return NULL;
+}
+
+const struct Repr *
+repr_merge(struct Repr_Format *fmt, const struct Repr *a, const struct Repr *b)
+{
+	assert(a->key == b->key);
+	struct Repr *r = new_zeroed(struct Repr);
+
+	r->key = a->key;
+	if (a->name != NULL && b->name != NULL)
+		xasprintf(&r->name, "%s|%s", a->name, b->name);
+	if (a->decode == b->decode)
+		r->decode = a->decode;
+	if (a->children == b->children)
+		r->children = a->children;
+	if (a->utag == b->utag)
+		r->utag = a->utag;
+
+	hlist_add_head(&r->_node, &fmt->nodes);
+	return r;
+}
+
 #ifdef DEBUG
 static void
 debug_show_format(const struct Repr_Format *fmt)
@@ -355,6 +508,22 @@ check_format_argument(struct hlist_head *libs, const char *conf_path)
 	return 0;
 }
 
+/* Does the file contain an ASN.1 module (rather than configuration)? */
+static bool
+module_p(FILE *f)
+{
+	char *line = NULL;
+	size_t sz = 0;
+	bool rv = false;
+
+	while (!rv && getline(&line, &sz, f) >= 0)
+		rv = strstr(line, "::=") != NULL;
+
+	free(line);
+	rewind(f);
+	return rv;
+}
+
 int
 repr_create(struct Repr_Format *dest, const char *conf_path)
 {
@@ -369,10 +538,19 @@ repr_create(struct Repr_Format *dest, const char *conf_path)
 		return -1;
 	}
 
-	assert(dest->dict == NULL);
-	const int rv = parse_conf(dest, f, conf_path);
-
+	assert(dest->dict == NULL && dest->top == NULL);
+	const int rv = module_p(f) ? schema_compile(dest, f, conf_path) :
+		parse_conf(dest, f, conf_path);
 	fclose(f);
+
+	if (rv == 0 && dest->top != NULL && dest->top->n == 1) {
+		/* The only kind of top-level tags */
+		size_t i;
+		for (i = 0; dest->top->slots[i] == NULL; ++i)
+			;
+		dest->root = dest->top->slots[i];
+	}
+
 	return rv;
 }
 
@@ -383,20 +561,48 @@ htab_getitem(const struct hlist_head *htab, uint32_t key)
 		: bucket_getitem(htab + hash_long(key, HASH_NBITS), key);
 }
 
+int
+repr_root(const struct Repr_Format *fmt, enum Tag_Class *cls, uint32_t *num)
+{
+	if (fmt->root == NULL)
+		return -1;
+
+	*cls = fmt->root->key >> 30;
+	*num = fmt->root->key & 0x3fffffff;
+	return 0;
+}
+
+const struct Repr *
+repr_find(const struct Repr_Format *fmt, const struct Repr *parent,
+	  bool root_p, enum Tag_Class cls, uint32_t num)
+{
+	const uint32_t key = tagkey(cls, num);
+
+	if (fmt->top == NULL)
+		return htab_getitem(fmt->dict, key);
+
+	const struct Repr_Table *t = root_p ? fmt->top :
+		parent == NULL ? NULL : parent->children;
+	return t == NULL ? NULL : *table_slot(t, key);
+}
+
 void
-repr_show_header(const struct Repr_Format *fmt, enum Tag_Class cls,
-		 uint32_t num)
+repr_show(const struct Repr *r, enum Tag_Class cls, uint32_t num)
 {
-	const struct Repr *r = htab_getitem(fmt->dict, tagkey(cls, num));
-	if (r == NULL)
+	if (r == NULL || r->name == NULL)
 		printf("%c%u", "uacp"[cls], num);
 	else
 		printf(":%s", r->name);
 }
 
 Repr_Codec
-repr_from_raw(const struct Repr_Format *fmt, enum Tag_Class cls, uint32_t num)
+repr_from_raw(const struct Repr *r)
 {
-	const struct Repr *r = htab_getitem(fmt->dict, tagkey(cls, num));
 	return r == NULL ? NULL : r->decode;
 }
+
+uint32_t
+repr_utag(const struct Repr *r)
+{
+	return r == NULL ? 0 : r->utag;
+}
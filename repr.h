@@ -8,10 +8,14 @@
 #ifndef _REPR_H
 #define _REPR_H
 
+#include <stddef.h>
+
 #include "list.h"
 #include "asn1.h"
 
 struct Buffer;
+struct Repr;
+struct Repr_Table;
 
 /*
  * Format specification.
@@ -22,18 +26,61 @@ struct Buffer;
 struct Repr_Format {
 	struct hlist_head *dict; /* Dictionary of tags' representations */
 	struct hlist_head libs; /* Plugins in use */
+
+	/*
+	 * Representation of top-level tags, i.e. the first entry of
+	 * format specification; NULL if the specification is empty.
+	 */
+	const struct Repr *root;
+
+	/*
+	 * Compiled ASN.1 module (see schema.h); representations of
+	 * its tags depend on the context.
+	 */
+	struct Repr_Table *top; /* Top-level tags; NULL if there's no module */
+	struct hlist_head nodes; /* All representations of the module */
+	struct Repr_Table *tables; /* All tables of the module */
 };
-#define REPR_FORMAT(name) struct Repr_Format name = { NULL, HLIST_HEAD_INIT }
+#define REPR_FORMAT(name) \
+	struct Repr_Format name = { NULL, HLIST_HEAD_INIT, NULL, NULL, \
+				    HLIST_HEAD_INIT, NULL }
 
-/* Read configuration file and fill `dest' */
+/*
+ * Read format specification and fill `dest'.
+ *
+ * The specification is either a configuration file (a `TAG NAME
+ * [CODEC]' entry per line) or an ASN.1 module.
+ */
 int repr_create(struct Repr_Format *dest, const char *conf_path);
 
 /* Free resources allocated for `fmt' */
 void repr_destroy(struct Repr_Format *fmt);
 
-/* Print tag header's representation to stdout */
-void repr_show_header(const struct Repr_Format *fmt, enum Tag_Class cls,
-		      uint32_t num);
+/*
+ * Get class and number of top-level tags.
+ *
+ * Return -1 if format specification does not define them, otherwise
+ * return 0.
+ */
+int repr_root(const struct Repr_Format *fmt, enum Tag_Class *cls,
+	      uint32_t *num);
+
+/*
+ * Find representation of a tag.
+ *
+ * @parent: representation of the container; NULL for top-level tags
+ *          or if the container's representation is unknown
+ * @root_p: is it a top-level tag?
+ *
+ * Return NULL if format specification does not define representation
+ * of the tag (in given context).
+ */
+const struct Repr *repr_find(const struct Repr_Format *fmt,
+			     const struct Repr *parent, bool root_p,
+			     enum Tag_Class cls, uint32_t num);
+
+/* Print tag header's representation (`r' can be NULL) to stdout */
+void repr_show(const struct Repr *r, enum Tag_Class cls, uint32_t num);
 
 /*
  * Repr_Codec -- type of function that converts raw bytes to
@@ -56,7 +103,56 @@ typedef int (*Repr_Codec)(struct Buffer *dest, const uint8_t *src, size_t n);
  *
  * Returned value can be NULL.
  */
-Repr_Codec repr_from_raw(const struct Repr_Format *fmt, enum Tag_Class cls,
-			 uint32_t num);
+Repr_Codec repr_from_raw(const struct Repr *r);
+
+/*
+ * Return the universal type of primitive contents of the tag, as the
+ * ASN.1 module defines it (e.g., INTEGER for `[PRIVATE 10] INTEGER');
+ * 0 if it is unknown.
+ */
+uint32_t repr_utag(const struct Repr *r);
+
+/*
+ * Interface for compilers of format specifications (see schema.c)
+ */
+
+/* Make key of a tag */
+static inline uint32_t
+tagkey(enum Tag_Class cls, uint32_t num)
+{
+	return cls << 30 | num;
+}
+
+/*
+ * Create representation of a tag, owned by `fmt'.
+ *
+ * @name: human-friendly name of the tag (or NULL)
+ * @codec: name of the type of primitive contents; its decoder
+ *         (`decode_CODEC') is looked up in format's plugin
+ */
+struct Repr *repr_new(struct Repr_Format *fmt, uint32_t key,
+		      const char *name, const char *codec);
+
+/* Create an empty table of representations, owned by `fmt' */
+struct Repr_Table *repr_table_new(struct Repr_Format *fmt);
+
+/*
+ * Put representation into the table, replacing the one with the same
+ * key.  Return the replaced representation (NULL if there was none).
+ */
+const struct Repr *repr_table_put(struct Repr_Table *t, const struct Repr *r);
+
+/*
+ * Create representation of a tag that stands for either `a' or `b'
+ * (e.g., components of SEQUENCE that share a tag).
+ */
+const struct Repr *repr_merge(struct Repr_Format *fmt, const struct Repr *a,
+			      const struct Repr *b);
+
+/* Set representations of child tags */
+void repr_set_children(struct Repr *r, const struct Repr_Table *t);
+
+/* Set universal type of primitive contents (see `repr_utag') */
+void repr_set_utag(struct Repr *r, uint32_t utag);
 
 #endif /* _REPR_H */
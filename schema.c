@@ -0,0 +1,973 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "schema.h"
+#include "repr.h"
+#include "asn1.h"
+#include "util.h"
+
+/*
+ * Lexer
+ */
+
+enum Token {
+	TK_EOF,
+	TK_IDENT, /* identifier or keyword */
+	TK_NUMBER,
+	TK_STRING, /* "..." or '...'H */
+	TK_OTHER /* `::=', `...', `..' or any other character */
+};
+
+struct Lexer {
+	const char *p; /* Next character */
+	unsigned long line; /* Current line number */
+
+	enum Token tok; /* Current token */
+	const char *text; /* Text of current token */
+	size_t len; /* Length of the text */
+};
+
+/* Skip white space and comments, counting lines */
+static const char *
+skip_blanks(const char *p, unsigned long *line)
+{
+	for (;;) {
+		if (isspace((unsigned char) *p)) {
+			if (*p == '\n')
+				++*line;
+			++p;
+		} else if (p[0] == '-' && p[1] == '-') {
+			/* Comment ends with `--' or newline */
+			for (p += 2; *p != 0 && *p != '\n'; ++p) {
+				if (p[0] == '-' && p[1] == '-') {
+					p += 2;
+					break;
+				}
+			}
+		} else if (p[0] == '/' && p[1] == '*') {
+			for (p += 2; *p != 0 && !(p[0] == '*' && p[1] == '/');
+			     ++p) {
+				if (*p == '\n')
+					++*line;
+			}
+			if (*p != 0)
+				p += 2;
+		} else {
+			return p;
+		}
+	}
+}
+
+static void
+next_token(struct Lexer *lx)
+{
+	const char *p = skip_blanks(lx->p, &lx->line);
+	lx->text = p;
+
+	if (*p == 0) {
+		lx->tok = TK_EOF;
+	} else if (isalpha((unsigned char) *p)) {
+		for (++p; isalnum((unsigned char) *p) ||
+			     (*p == '-' && isalnum((unsigned char) p[1])); ++p)
+			;
+		lx->tok = TK_IDENT;
+	} else if (isdigit((unsigned char) *p)) {
+		while (isdigit((unsigned char) *++p))
+			;
+		lx->tok = TK_NUMBER;
+	} else if (*p == '"' || *p == '\'') {
+		const char q = *p;
+		for (++p; *p != 0 && *p != q; ++p)
+			if (*p == '\n')
+				++lx->line;
+		if (*p != 0)
+			++p;
+		if (q == '\'' && isalpha((unsigned char) *p))
+			++p; /* 'H or 'B suffix */
+		lx->tok = TK_STRING;
+	} else {
+		if (strncmp(p, "::=", 3) == 0 || strncmp(p, "...", 3) == 0)
+			p += 3;
+		else if (strncmp(p, "..", 2) == 0)
+			p += 2;
+		else
+			++p;
+		lx->tok = TK_OTHER;
+	}
+
+	lx->len = p - lx->text;
+	lx->p = p;
+}
+
+/* Is the text of current token equal to `s'? */
+static bool
+token_is(const struct Lexer *lx, const char *s)
+{
+	return lx->tok != TK_EOF && strlen(s) == lx->len &&
+		memcmp(lx->text, s, lx->len) == 0;
+}
+
+/* Return the first character of the next token */
+static char
+peek_char(const struct Lexer *lx)
+{
+	unsigned long line = lx->line;
+	return *skip_blanks(lx->p, &line);
+}
+
+/*
+ * Abstract syntax
+ */
+
+struct Type;
+
+/* Component of SEQUENCE, SET or CHOICE; element of SEQUENCE OF */
+struct Field {
+	struct Field *next;
+	char *name; /* NULL for unnamed elements */
+	struct Type *type;
+};
+
+enum Type_Kind {
+	TY_TAGGED,
+	TY_SEQUENCE,
+	TY_SET,
+	TY_CHOICE,
+	TY_SEQUENCE_OF,
+	TY_SET_OF,
+	TY_PRIMITIVE,
+	TY_REFERENCE
+};
+
+enum Tagging { TG_DEFAULT, TG_IMPLICIT, TG_EXPLICIT };
+
+struct Type {
+	struct Type *next; /* Next type of the module (see `Module.types') */
+	enum Type_Kind kind;
+	unsigned long line; /* Where the type is defined */
+
+	union {
+		struct { /* TY_TAGGED */
+			uint32_t key; /* see `tagkey' */
+			enum Tagging tagging;
+			struct Type *inner;
+		} tagged;
+		struct Field *fields; /* TY_SEQUENCE, TY_SET, TY_CHOICE */
+		struct Field *elem; /* TY_SEQUENCE_OF, TY_SET_OF */
+		uint32_t utag; /* TY_PRIMITIVE: universal tag number */
+		char *ref; /* TY_REFERENCE: name of the type */
+	} u;
+
+	/* Compilation (see `contents') */
+	const struct Repr_Table *contents;
+	bool contents_p; /* Is `contents' computed (or being computed)? */
+	bool busy_p; /* Are alternatives of CHOICE being added? */
+};
+
+/* Type assignment */
+struct Assignment {
+	struct Assignment *next;
+	char *name;
+	struct Type *type;
+};
+
+struct Module {
+	struct Repr_Format *fmt;
+	const char *path;
+	struct Lexer lx;
+
+	enum Tagging tagging; /* Tagging environment: explicit or implicit */
+	bool automatic_p; /* AUTOMATIC TAGS environment? */
+
+	struct Assignment *defs; /* Type assignments */
+	struct Assignment **defs_tail;
+	unsigned ndefs; /* Number of assignments */
+
+	struct Type *types; /* All types, linked through `next' field */
+};
+
+static int
+error_at(const struct Module *m, unsigned long line, const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+
+	fprintf(stderr, "%s:%lu: ", m->path, line);
+	vfprintf(stderr, format, ap);
+	fputc('\n', stderr);
+
+	va_end(ap);
+	return -1;
+}
+
+static int
+syntax_error(const struct Module *m, const char *what)
+{
+	const struct Lexer *lx = &m->lx;
+
+	if (lx->tok == TK_EOF)
+		return error_at(m, lx->line, "Syntax error: %s", what);
+	else
+		return error_at(m, lx->line, "Syntax error: %s, got `%.*s'",
+				what, (int) lx->len, lx->text);
+}
+
+/* Consume token `s' */
+static int
+expect(struct Module *m, const char *s)
+{
+	if (!token_is(&m->lx, s)) {
+		char what[64];
+		snprintf(what, sizeof(what), "`%s' expected", s);
+		return syntax_error(m, what);
+	}
+
+	next_token(&m->lx);
+	return 0;
+}
+
+static char *
+token_dup(const struct Lexer *lx)
+{
+	char *s = NULL;
+	xasprintf(&s, "%.*s", (int) lx->len, lx->text);
+	return s;
+}
+
+static struct Type *
+new_type(struct Module *m, enum Type_Kind kind)
+{
+	struct Type *t = new_zeroed(struct Type);
+
+	t->kind = kind;
+	t->line = m->lx.line;
+
+	t->next = m->types;
+	m->types = t;
+	return t;
+}
+
+static void
+free_fields(struct Field *f)
+{
+	while (f != NULL) {
+		struct Field *next = f->next;
+		free(f->name);
+		free(f);
+		f = next;
+	}
+}
+
+static void
+free_module(struct Module *m)
+{
+	while (m->types != NULL) {
+		struct Type *t = m->types;
+		m->types = t->next;
+
+		if (t->kind == TY_SEQUENCE || t->kind == TY_SET ||
+		    t->kind == TY_CHOICE)
+			free_fields(t->u.fields);
+		else if (t->kind == TY_SEQUENCE_OF || t->kind == TY_SET_OF)
+			free_fields(t->u.elem);
+		else if (t->kind == TY_REFERENCE)
+			free(t->u.ref);
+		free(t);
+	}
+
+	while (m->defs != NULL) {
+		struct Assignment *next = m->defs->next;
+		free(m->defs->name);
+		free(m->defs);
+		m->defs = next;
+	}
+}
+
+/*
+ * Parser
+ */
+
+/* Skip bracketed group -- `(...)' or `{...}' */
+static int
+skip_group(struct Module *m)
+{
+	struct Lexer *lx = &m->lx;
+	unsigned depth = 0;
+
+	do {
+		if (lx->tok == TK_EOF)
+			return syntax_error(m, "unbalanced brackets");
+
+		if (token_is(lx, "(") || token_is(lx, "{"))
+			++depth;
+		else if (token_is(lx, ")") || token_is(lx, "}"))
+			--depth;
+
+		next_token(lx);
+	} while (depth != 0);
+
+	return 0;
+}
+
+static int
+skip_constraints(struct Module *m)
+{
+	while (token_is(&m->lx, "("))
+		if (skip_group(m) != 0)
+			return -1;
+	return 0;
+}
+
+/* Skip value (up to `,', `}' or `]') */
+static int
+skip_value(struct Module *m)
+{
+	struct Lexer *lx = &m->lx;
+
+	while (!token_is(lx, ",") && !token_is(lx, "}") && !token_is(lx, "]")) {
+		if (lx->tok == TK_EOF)
+			return syntax_error(m, "value expected");
+
+		if (token_is(lx, "{") || token_is(lx, "(")) {
+			if (skip_group(m) != 0)
+				return -1;
+		} else {
+			next_token(lx);
+		}
+	}
+
+	return 0;
+}
+
+/* Built-in types [ITU-T X.680, 17.1] */
+static const struct {
+	const char *name[2]; /* keyword(s) */
+	uint32_t utag;
+} builtins[] = {
+	{ { "BOOLEAN", NULL }, UT_BOOLEAN },
+	{ { "INTEGER", NULL }, UT_INTEGER },
+	{ { "BIT", "STRING" }, UT_BIT_STRING },
+	{ { "OCTET", "STRING" }, UT_OCTET_STRING },
+	{ { "NULL", NULL }, UT_NULL },
+	{ { "OBJECT", "IDENTIFIER" }, UT_OBJECT_IDENTIFIER },
+	{ { "ObjectDescriptor", NULL }, UT_OBJECT_DESCRIPTOR },
+	{ { "REAL", NULL }, UT_REAL },
+	{ { "ENUMERATED", NULL }, UT_ENUMERATED },
+	{ { "UTF8String", NULL }, UT_UTF8_STRING },
+	{ { "RELATIVE-OID", NULL }, UT_RELATIVE_OID },
+	{ { "NumericString", NULL }, UT_NUMERIC_STRING },
+	{ { "PrintableString", NULL }, UT_PRINTABLE_STRING },
+	{ { "TeletexString", NULL }, UT_TELETEX_STRING },
+	{ { "T61String", NULL }, UT_TELETEX_STRING },
+	{ { "VideotexString", NULL }, UT_VIDEOTEX_STRING },
+	{ { "IA5String", NULL }, UT_IA5_STRING },
+	{ { "UTCTime", NULL }, UT_UTC_TIME },
+	{ { "GeneralizedTime", NULL }, UT_GENERALIZED_TIME },
+	{ { "GraphicString", NULL }, UT_GRAPHIC_STRING },
+	{ { "VisibleString", NULL }, UT_VISIBLE_STRING },
+	{ { "ISO646String", NULL }, UT_VISIBLE_STRING },
+	{ { "GeneralString", NULL }, UT_GENERAL_STRING },
+	{ { "UniversalString", NULL }, UT_UNIVERSAL_STRING },
+	{ { "BMPString", NULL }, UT_BMP_STRING }
+};
+
+static struct Type *parse_type(struct Module *m);
+
+/*
+ * Parse components of SEQUENCE, SET or CHOICE.
+ * Untagged components get automatic tags, if module says so.
+ */
+static int
+parse_fields(struct Module *m, struct Field **dest)
+{
+	struct Lexer *lx = &m->lx;
+	struct Field **tail = dest;
+	bool tagged_p = false;
+
+	if (expect(m, "{") != 0)
+		return -1;
+
+	while (!token_is(lx, "}")) {
+		if (token_is(lx, "...")) { /* extension marker */
+			next_token(lx);
+			if (token_is(lx, "!") && skip_value(m) != 0)
+				return -1;
+		} else if (token_is(lx, "[") && peek_char(lx) == '[') {
+			/* start of extension addition group, `[[' */
+			next_token(lx);
+			next_token(lx);
+			if (lx->tok == TK_NUMBER) { /* version number */
+				next_token(lx);
+				if (expect(m, ":") != 0)
+					return -1;
+			}
+			continue;
+		} else if (token_is(lx, "]") && peek_char(lx) == ']') {
+			next_token(lx);
+			next_token(lx);
+		} else {
+			if (token_is(lx, "COMPONENTS"))
+				return error_at(m, lx->line, "COMPONENTS OF is"
+						" not supported");
+			if (lx->tok != TK_IDENT ||
+			    !islower((unsigned char) *lx->text))
+				return syntax_error(m, "component name"
+						    " expected");
+
+			struct Field *f = new_zeroed(struct Field);
+			*tail = f;
+			tail = &f->next;
+
+			f->name = token_dup(lx);
+			next_token(lx);
+
+			if ((f->type = parse_type(m)) == NULL)
+				return -1;
+			tagged_p |= f->type->kind == TY_TAGGED;
+
+			if (token_is(lx, "OPTIONAL")) {
+				next_token(lx);
+			} else if (token_is(lx, "DEFAULT")) {
+				next_token(lx);
+				if (skip_value(m) != 0)
+					return -1;
+			}
+		}
+
+		if (token_is(lx, ","))
+			next_token(lx);
+		else if (!token_is(lx, "}") && !token_is(lx, "]"))
+			return syntax_error(m, "`,' or `}' expected");
+	}
+	next_token(lx);
+
+	if (m->automatic_p && !tagged_p) {
+		/* Automatic tagging [ITU-T X.680, 24.7] */
+		uint32_t n = 0;
+		struct Field *f;
+
+		for (f = *dest; f != NULL; f = f->next) {
+			struct Type *t = new_type(m, TY_TAGGED);
+			t->u.tagged.key = tagkey(TC_CONTEXT, n++);
+			t->u.tagged.inner = f->type;
+			f->type = t;
+		}
+	}
+
+	return 0;
+}
+
+/* Parse tag -- `[CLASS NUMBER]' -- and the type that follows */
+static struct Type *
+parse_tagged(struct Module *m)
+{
+	struct Lexer *lx = &m->lx;
+	enum Tag_Class cls = TC_CONTEXT;
+
+	next_token(lx); /* `[' */
+
+	if (token_is(lx, "UNIVERSAL")) {
+		cls = TC_UNIVERSAL;
+		next_token(lx);
+	} else if (token_is(lx, "APPLICATION")) {
+		cls = TC_APPLICATION;
+		next_token(lx);
+	} else if (token_is(lx, "PRIVATE")) {
+		cls = TC_PRIVATE;
+		next_token(lx);
+	}
+
+	if (lx->tok != TK_NUMBER) {
+		syntax_error(m, "tag number expected");
+		return NULL;
+	}
+
+	const unsigned long num = strtoul(lx->text, NULL, 10);
+	if (lx->len > 10 || num > 0x3fffffff) {
+		error_at(m, lx->line, "Enormous tag number");
+		return NULL;
+	}
+
+	next_token(lx);
+	if (expect(m, "]") != 0)
+		return NULL;
+
+	struct Type *t = new_type(m, TY_TAGGED);
+	t->u.tagged.key = tagkey(cls, num);
+
+	if (token_is(lx, "IMPLICIT")) {
+		t->u.tagged.tagging = TG_IMPLICIT;
+		next_token(lx);
+	} else if (token_is(lx, "EXPLICIT")) {
+		t->u.tagged.tagging = TG_EXPLICIT;
+		next_token(lx);
+	}
+
+	return (t->u.tagged.inner = parse_type(m)) == NULL ? NULL : t;
+}
+
+static struct Type *
+parse_type(struct Module *m)
+{
+	struct Lexer *lx = &m->lx;
+	struct Type *t;
+
+	if (token_is(lx, "["))
+		return parse_tagged(m);
+
+	if (lx->tok != TK_IDENT) {
+		syntax_error(m, "type expected");
+		return NULL;
+	}
+
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(builtins); ++i)
+		if (token_is(lx, builtins[i].name[0]))
+			break;
+
+	if (token_is(lx, "SEQUENCE") || token_is(lx, "SET")) {
+		const bool seq_p = token_is(lx, "SEQUENCE");
+
+		next_token(lx);
+		if (token_is(lx, "SIZE")) /* SEQUENCE SIZE (...) OF */
+			next_token(lx);
+		if (skip_constraints(m) != 0)
+			return NULL;
+
+		if (token_is(lx, "OF")) {
+			next_token(lx);
+
+			t = new_type(m, seq_p ? TY_SEQUENCE_OF : TY_SET_OF);
+			struct Field *elem = t->u.elem =
+				new_zeroed(struct Field);
+
+			if (lx->tok == TK_IDENT &&
+			    islower((unsigned char) *lx->text)) {
+				elem->name = token_dup(lx);
+				next_token(lx);
+			}
+
+			if ((elem->type = parse_type(m)) == NULL)
+				return NULL;
+		} else {
+			t = new_type(m, seq_p ? TY_SEQUENCE : TY_SET);
+			if (parse_fields(m, &t->u.fields) != 0)
+				return NULL;
+		}
+	} else if (token_is(lx, "CHOICE")) {
+		next_token(lx);
+
+		t = new_type(m, TY_CHOICE);
+		if (parse_fields(m, &t->u.fields) != 0)
+			return NULL;
+	} else if (i < ARRAY_SIZE(builtins)) {
+		next_token(lx);
+		if (builtins[i].name[1] != NULL &&
+		    expect(m, builtins[i].name[1]) != 0)
+			return NULL;
+
+		t = new_type(m, TY_PRIMITIVE);
+		t->u.utag = builtins[i].utag;
+
+		/* Named numbers or bits */
+		if (token_is(lx, "{") && skip_group(m) != 0)
+			return NULL;
+	} else if (isupper((unsigned char) *lx->text)) {
+		t = new_type(m, TY_REFERENCE);
+		t->u.ref = token_dup(lx);
+		next_token(lx);
+	} else {
+		syntax_error(m, "type expected");
+		return NULL;
+	}
+
+	return skip_constraints(m) == 0 ? t : NULL;
+}
+
+/* Skip `IMPORTS ...;' or `EXPORTS ...;' */
+static int
+skip_clause(struct Module *m)
+{
+	struct Lexer *lx = &m->lx;
+
+	while (!token_is(lx, ";")) {
+		if (lx->tok == TK_EOF)
+			return syntax_error(m, "`;' expected");
+		next_token(lx);
+	}
+
+	next_token(lx);
+	return 0;
+}
+
+/* Skip value assignment -- `name Type ::= value' */
+static int
+skip_value_assignment(struct Module *m)
+{
+	struct Lexer *lx = &m->lx;
+
+	while (!token_is(lx, "::=")) {
+		if (lx->tok == TK_EOF)
+			return syntax_error(m, "`::=' expected");
+
+		if (token_is(lx, "{") || token_is(lx, "(")) {
+			if (skip_group(m) != 0)
+				return -1;
+		} else {
+			next_token(lx);
+		}
+	}
+	next_token(lx);
+
+	if (token_is(lx, "-")) /* negative number */
+		next_token(lx);
+
+	if (token_is(lx, "{"))
+		return skip_group(m);
+
+	if (lx->tok == TK_EOF)
+		return syntax_error(m, "value expected");
+
+	next_token(lx);
+	return 0;
+}
+
+static int
+parse_module(struct Module *m)
+{
+	struct Lexer *lx = &m->lx;
+	next_token(lx);
+
+	if (lx->tok != TK_IDENT)
+		return syntax_error(m, "module name expected");
+	next_token(lx);
+
+	if (token_is(lx, "{") && skip_group(m) != 0) /* object identifier */
+		return -1;
+
+	if (expect(m, "DEFINITIONS") != 0)
+		return -1;
+
+	m->tagging = TG_EXPLICIT;
+	if (token_is(lx, "EXPLICIT") || token_is(lx, "IMPLICIT") ||
+	    token_is(lx, "AUTOMATIC")) {
+		if (!token_is(lx, "EXPLICIT"))
+			m->tagging = TG_IMPLICIT;
+		m->automatic_p = token_is(lx, "AUTOMATIC");
+
+		next_token(lx);
+		if (expect(m, "TAGS") != 0)
+			return -1;
+	}
+
+	if (token_is(lx, "EXTENSIBILITY")) {
+		next_token(lx);
+		if (expect(m, "IMPLIED") != 0)
+			return -1;
+	}
+
+	if (expect(m, "::=") != 0 || expect(m, "BEGIN") != 0)
+		return -1;
+
+	while (!token_is(lx, "END")) {
+		if (lx->tok == TK_EOF)
+			return syntax_error(m, "`END' expected");
+
+		if (token_is(lx, "EXPORTS") || token_is(lx, "IMPORTS")) {
+			if (skip_clause(m) != 0)
+				return -1;
+		} else if (lx->tok == TK_IDENT &&
+			   isupper((unsigned char) *lx->text)) {
+			struct Assignment *a = new_zeroed(struct Assignment);
+			*m->defs_tail = a;
+			m->defs_tail = &a->next;
+			++m->ndefs;
+
+			a->name = token_dup(lx);
+			next_token(lx);
+
+			if (token_is(lx, "{"))
+				return error_at(m, lx->line, "Parameterized"
+						" types are not supported");
+
+			if (expect(m, "::=") != 0 ||
+			    (a->type = parse_type(m)) == NULL)
+				return -1;
+		} else if (lx->tok == TK_IDENT) {
+			if (skip_value_assignment(m) != 0)
+				return -1;
+		} else {
+			return syntax_error(m, "assignment expected");
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Compilation
+ *
+ * Each type (once references are resolved, and except for untagged
+ * CHOICE) is represented by its outermost tag.  A table of
+ * representations of the tags its contents may consist of is built
+ * for every constructed type (see `contents'); representations of
+ * child tags are found in that table.  Untagged CHOICE is represented
+ * by its alternatives.
+ */
+
+static const struct Type *
+find_type(const struct Module *m, const char *name)
+{
+	const struct Assignment *a;
+
+	for (a = m->defs; a != NULL; a = a->next)
+		if (streq(a->name, name))
+			return a->type;
+
+	return NULL;
+}
+
+/* Follow references; return NULL if a type is undefined */
+static struct Type *
+resolve(const struct Module *m, struct Type *t)
+{
+	unsigned n;
+
+	for (n = 0; t->kind == TY_REFERENCE; ++n) {
+		const struct Type *x = find_type(m, t->u.ref);
+
+		if (x == NULL) {
+			error_at(m, t->line, "Undefined type `%s'", t->u.ref);
+			return NULL;
+		} else if (n > m->ndefs) {
+			error_at(m, t->line, "Circular definition of `%s'",
+				 t->u.ref);
+			return NULL;
+		}
+
+		t = (struct Type *) x;
+	}
+
+	return t;
+}
+
+/* Key of the outermost tag of resolved type (not an untagged CHOICE) */
+static uint32_t
+outer_key(const struct Type *t)
+{
+	switch (t->kind) {
+	case TY_TAGGED:
+		return t->u.tagged.key;
+	case TY_SEQUENCE:
+	case TY_SEQUENCE_OF:
+		return tagkey(TC_UNIVERSAL, UT_SEQUENCE);
+	case TY_SET:
+	case TY_SET_OF:
+		return tagkey(TC_UNIVERSAL, UT_SET);
+	case TY_PRIMITIVE:
+		return tagkey(TC_UNIVERSAL, t->u.utag);
+	default:
+		assert(0 == 1);
+		return 0;
+	}
+}
+
+/* Name of the type whose decoder converts primitive contents of `t' */
+static const char *
+codec_name(const struct Type *t)
+{
+	while (t->kind == TY_TAGGED)
+		t = t->u.tagged.inner;
+
+	return t->kind == TY_REFERENCE ? t->u.ref : NULL;
+}
+
+/*
+ * Universal type of primitive contents of `t' (e.g., INTEGER for
+ * `[PRIVATE 10] INTEGER'); 0 if `t' is not a primitive type.
+ * References are expected to be resolvable.
+ */
+static uint32_t
+primitive_utag(const struct Module *m, struct Type *t)
+{
+	for (;;) {
+		t = resolve(m, t);
+		if (t->kind == TY_TAGGED)
+			t = t->u.tagged.inner;
+		else
+			return t->kind == TY_PRIMITIVE ? t->u.utag : 0;
+	}
+}
+
+static int contents(struct Module *m, struct Type *t,
+		    const struct Repr_Table **dest);
+
+/*
+ * Add representation(s) of type `t', known as `name' (can be NULL),
+ * to `dest'.
+ */
+static int
+add_entries(struct Module *m, struct Repr_Table *dest, const char *name,
+	    struct Type *t)
+{
+	struct Type *x = resolve(m, t);
+	if (x == NULL)
+		return -1;
+
+	if (x->kind == TY_CHOICE) {
+		if (x->busy_p)
+			return error_at(m, t->line, "CHOICE contains itself");
+
+		x->busy_p = true;
+
+		const struct Field *f;
+		for (f = x->u.fields; f != NULL; f = f->next)
+			if (add_entries(m, dest, f->name, f->type) != 0)
+				return -1;
+
+		x->busy_p = false;
+		return 0;
+	}
+
+	const struct Repr_Table *children;
+	if (contents(m, t, &children) != 0)
+		return -1;
+
+	struct Repr *r = repr_new(m->fmt, outer_key(x), name,
+				  children == NULL ? codec_name(t) : NULL);
+	repr_set_children(r, children);
+	if (children == NULL)
+		repr_set_utag(r, primitive_utag(m, t));
+
+	/* Components of SEQUENCE may share a tag */
+	const struct Repr *old = repr_table_put(dest, r);
+	if (old != NULL)
+		repr_table_put(dest, repr_merge(m->fmt, old, r));
+
+	return 0;
+}
+
+/*
+ * Get the table of representations of the tags that contents of
+ * type `t' consist of; NULL for primitive types.
+ */
+static int
+contents(struct Module *m, struct Type *t, const struct Repr_Table **dest)
+{
+	if (t->contents_p) { /* computed already (or being computed) */
+		*dest = t->contents;
+		return 0;
+	}
+	t->contents_p = true;
+
+	struct Repr_Table *tbl = NULL;
+	struct Type *x;
+	const struct Field *f;
+
+	switch (t->kind) {
+	case TY_TAGGED:
+		if ((x = resolve(m, t->u.tagged.inner)) == NULL)
+			return -1;
+
+		if (x->kind == TY_CHOICE || /* tagged CHOICE is explicit */
+		    t->u.tagged.tagging == TG_EXPLICIT ||
+		    (t->u.tagged.tagging == TG_DEFAULT &&
+		     m->tagging == TG_EXPLICIT)) {
+			t->contents = tbl = repr_table_new(m->fmt);
+
+			x = t->u.tagged.inner;
+			if (add_entries(m, tbl, x->kind == TY_REFERENCE ?
+					x->u.ref : NULL, x) != 0)
+				return -1;
+		} else if (contents(m, t->u.tagged.inner, &t->contents) != 0) {
+			return -1;
+		}
+		break;
+
+	case TY_SEQUENCE:
+	case TY_SET:
+	case TY_CHOICE:
+		t->contents = tbl = repr_table_new(m->fmt);
+
+		for (f = t->u.fields; f != NULL; f = f->next)
+			if (add_entries(m, tbl, f->name, f->type) != 0)
+				return -1;
+		break;
+
+	case TY_SEQUENCE_OF:
+	case TY_SET_OF:
+		t->contents = tbl = repr_table_new(m->fmt);
+
+		f = t->u.elem;
+		if (add_entries(m, tbl, f->name != NULL ? f->name :
+				f->type->kind == TY_REFERENCE ?
+				f->type->u.ref : NULL, f->type) != 0)
+			return -1;
+		break;
+
+	case TY_PRIMITIVE:
+		break;
+
+	case TY_REFERENCE:
+		if ((x = resolve(m, t)) == NULL ||
+		    contents(m, x, &t->contents) != 0)
+			return -1;
+		break;
+
+	default:
+		assert(0 == 1);
+	}
+
+	*dest = t->contents;
+	return 0;
+}
+
+int
+schema_compile(struct Repr_Format *fmt, FILE *f, const char *path)
+{
+	char *text = NULL;
+	size_t sz = 0;
+
+	if (getdelim(&text, &sz, 0, f) < 0 && ferror(f)) {
+		error(0, errno, "%s", path);
+		free(text);
+		return -1;
+	}
+
+	struct Module m;
+	memset(&m, 0, sizeof(m));
+	m.fmt = fmt;
+	m.path = path;
+	m.lx.p = text == NULL ? "" : text;
+	m.lx.line = 1;
+	m.defs_tail = &m.defs;
+
+	int rv = parse_module(&m);
+
+	if (rv == 0 && m.defs == NULL)
+		rv = error_at(&m, m.lx.line, "No type assignments");
+
+	if (rv == 0) {
+		fmt->top = repr_table_new(fmt);
+		rv = add_entries(&m, fmt->top, m.defs->name, m.defs->type);
+	}
+
+	/* Check the types that are not reachable from the first one */
+	const struct Assignment *a;
+	const struct Repr_Table *unused;
+	for (a = m.defs; rv == 0 && a != NULL; a = a->next)
+		rv = contents(&m, a->type, &unused);
+
+	free_module(&m);
+	free(text);
+	return rv;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _SCHEMA_H
+#define _SCHEMA_H
+
+#include <stdio.h>
+
+struct Repr_Format;
+
+/*
+ * Compile ASN.1 module, read from `f', into representations of tags
+ * that depend on the context -- the types of containing tags.
+ *
+ * Supported subset of ASN.1 [ITU-T X.680]: type assignments;
+ * SEQUENCE, SET, CHOICE, SEQUENCE OF and SET OF types; built-in
+ * primitive types and references to other types of the module; tags,
+ * IMPLICIT/EXPLICIT keywords and tagging environment of the module
+ * (including AUTOMATIC TAGS).  Constraints, named numbers, DEFAULT
+ * values, extension markers, IMPORTS, EXPORTS and value assignments
+ * are skipped.
+ *
+ * The first type of the module describes top-level tags.  Contents of
+ * a primitive type assigned to a name (e.g., `TBCDstring ::= OCTET
+ * STRING') are decoded by `decode_NAME' function of format's plugin,
+ * if the plugin defines one.  Otherwise tags of built-in primitive
+ * types, implicitly tagged ones included, have the typed
+ * representations of these types (see universal.h).
+ *
+ * Return 0 on success; otherwise print error message and return -1.
+ */
+int schema_compile(struct Repr_Format *fmt, FILE *f, const char *path);
+
+#endif /* _SCHEMA_H */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+
+#include "split.h"
+#include "util.h"
+
+/* Write bytes [start, end) of the file to a new shard */
+static int
+write_shard(struct Records *r, off_t start, off_t end, const char *inpath,
+	    struct Output *out)
+{
+	if (output_next(out) != 0)
+		return -1;
+
+	if (copy_range(out->fd, r->fd, start, end - start) != 0) {
+		error(0, errno, "%s: copying failed", inpath);
+		return -1;
+	}
+
+	return output_close(out);
+}
+
+int
+split_file(const struct Split *sp, const char *inpath, struct Output *out)
+{
+	struct Records r;
+	if (records_open(&r, inpath) != 0)
+		return -1;
+
+	const off_t total = r.end;
+	off_t start = 0; /* Start of current shard */
+	off_t prev = 0; /* End of the previous record */
+	unsigned long k = 1; /* Number of the next cut (`nshards' mode) */
+	struct Record rec;
+	int found;
+	int retval = 0;
+
+	while ((found = next_record(&r, &rec)) > 0 && retval == 0) {
+		const off_t end = record_end(&rec);
+
+		if (sp->nshards == 0) {
+			if (end - start > sp->maxsize && prev > start) {
+				retval = write_shard(&r, start, prev, inpath,
+						     out);
+				start = prev;
+			}
+		} else {
+			/* Cut at the boundary nearest to k-th target */
+			for (; k < sp->nshards && retval == 0; ++k) {
+				const off_t target = total / sp->nshards * k +
+					total % sp->nshards * k / sp->nshards;
+				if (end < target)
+					break;
+
+				const off_t cut = target - prev <= end - target
+					? prev : end;
+				if (cut > start) {
+					retval = write_shard(&r, start, cut,
+							     inpath, out);
+					start = cut;
+				}
+			}
+		}
+
+		prev = end;
+	}
+
+	if (found < 0) {
+		error_at_line(0, 0, inpath, r.pos, "%s", r.errmsg);
+		retval = -1;
+	} else if (retval == 0 && total > start) {
+		retval = write_shard(&r, start, total, inpath, out);
+	}
+
+	records_close(&r);
+	return retval;
+}
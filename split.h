@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _SPLIT_H
+#define _SPLIT_H
+
+/*
+ * Splitting of DER files into shards
+ *
+ * Shards are cut at the boundaries of top-level records; the
+ * contents of records are not read.
+ */
+
+#include "records.h"
+
+/* Splitting criterion; exactly one of the fields is not zero */
+struct Split {
+	unsigned long nshards; /* Number of shards of (nearly) equal size */
+	off_t maxsize; /* Maximal size of shard */
+};
+
+/*
+ * Split a file, writing the shards to separate files.
+ *
+ * A shard may be smaller than requested if records are large.
+ * Similarly, a shard exceeds `maxsize' if it consists of a single
+ * record that does.
+ *
+ * Return value: 0 - success, -1 - error.
+ */
+int split_file(const struct Split *sp, const char *inpath,
+	       struct Output *out);
+
+#endif /* _SPLIT_H */
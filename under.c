@@ -18,17 +18,37 @@
  */
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 #include <assert.h>
 #include <libgen.h>
 #include <getopt.h>
+#include <unistd.h>
 
 #include "util.h"
 #include "buffer.h"
 #include "codec.h"
+#include "encoder.h"
 #include "repr.h"
+#include "oid.h"
+#include "pem.h"
+#include "gunzip.h"
+#include "prefetch.h"
+#include "extract.h"
+#include "split.h"
+#include "cat.h"
 
 #define VERSION "0.4.0-sid"
 
+/* Ring of buffers for reading ahead (see `readahead_p') */
+#ifdef DEBUG
+#  define READAHEAD_BUFSIZE 5
+#else
+#  define READAHEAD_BUFSIZE (64 * 1024)
+#endif
+#define READAHEAD_NBUFS 4
+
 /*
  * Adjust buffer to the blocksize of a file.
  *
@@ -93,72 +113,327 @@ read_block(void *dest, size_t size, FILE *src, struct Stream *str)
 	return n;
 }
 
+/*
+ * Should the file be read ahead in a separate thread?
+ *
+ * Reading from pipes, FIFOs and sockets, as well as from network file
+ * systems, blocks for a long time, so it is better overlapped with
+ * decoding.  Local files are served from page cache quickly enough.
+ */
+static bool
+readahead_p(FILE *f)
+{
+	struct stat st;
+	struct statfs sfs;
+
+	if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode))
+		return true;
+
+	return fstatfs(fileno(f), &sfs) == 0 &&
+		(sfs.f_type == NFS_SUPER_MAGIC || sfs.f_type == SMB_SUPER_MAGIC);
+}
+
+/* Source of input chunks */
+struct Source {
+	FILE *f;
+	struct Buffer *buf;
+	struct Pipeline *pipe; /* NULL if `f' is read synchronously */
+
+	const uint8_t *mem; /* Contents of prefetched file (or NULL) */
+	size_t memsize; /* Number of bytes in `mem' left to pass */
+
+	void *map; /* Memory mapping of `f' (or NULL) */
+	size_t mapsize;
+
+	struct Pem *pem; /* PEM decoder (NULL if the input is not PEM) */
+	const uint8_t *armored; /* PEM data not decoded yet */
+	size_t armsize; /* Number of bytes in `armored' */
+};
+
+/*
+ * Map a regular file into memory, so that the encoder gets whole
+ * records in a chunk and can encode them length-first (see encoder.c).
+ * The file is read as usual if it cannot be mapped.
+ */
+static void
+map_file(struct Source *src)
+{
+	struct stat st;
+
+	if (fstat(fileno(src->f), &st) != 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0 || (uint64_t) st.st_size > SIZE_MAX ||
+	    readahead_p(src->f))
+		return;
+
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		       fileno(src->f), 0);
+	if (p == MAP_FAILED)
+		return;
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+	src->map = p;
+	src->mem = p;
+	src->memsize = src->mapsize = st.st_size;
+}
+
+/* Size of chunks that prefetched data are passed in */
+#ifdef DEBUG
+#  define MEMORY_CHUNK 5
+#else
+#  define MEMORY_CHUNK SIZE_MAX
+#endif
+
+/* Number of PEM bytes decoded at once */
+#define PEM_SLICE READAHEAD_BUFSIZE
+
+/* Get another chunk of data as they are read; see `next_chunk' */
+static size_t
+next_raw_chunk(struct Source *src, struct Stream *str)
+{
+	if (src->pipe != NULL)
+		return pipeline_next(src->pipe, &str->data, &str->errmsg);
+
+	if (src->mem != NULL) {
+		const size_t n = MIN(src->memsize, MEMORY_CHUNK);
+		str->data = src->mem;
+		src->mem += n;
+		src->memsize -= n;
+		return n;
+	}
+
+	str->data = src->buf->wptr;
+	return read_block(src->buf->wptr, src->buf->size, src->f, str);
+}
+
+/*
+ * Get another chunk of input data, storing its address in `str->data'.
+ * PEM data are decoded into DER, a slice at a time.
+ *
+ * Return the size of chunk; see `read_block'.
+ */
+static size_t
+next_chunk(struct Source *src, struct Stream *str)
+{
+	if (src->pem == NULL)
+		return next_raw_chunk(src, str);
+
+	for (;;) {
+		if (src->armsize == 0) {
+			src->armsize = next_raw_chunk(src, str);
+			src->armored = str->data;
+
+			if (src->armsize == 0) {
+				if (str->errmsg == NULL)
+					pem_finish(src->pem, &str->errmsg);
+				return 0;
+			}
+		}
+
+		const size_t k = MIN(src->armsize, PEM_SLICE);
+		const size_t n = pem_decode(src->pem, src->armored, k,
+					    &str->data, &str->errmsg);
+		src->armored += k;
+		src->armsize -= k;
+
+		if (n != 0 || str->errmsg != NULL)
+			return n;
+	}
+}
+
+/* Input file being processed */
+struct Input {
+	const char *path;
+	size_t pos; /* Number of bytes consumed by codec */
+	size_t errpos; /* Position of the latest error */
+	unsigned nerrors; /* Number of errors reported */
+};
+
+/*
+ * Feed a chunk to the codec.
+ *
+ * In CF_KEEP_GOING mode try to recover from errors, reporting each
+ * of them along with the ranges of skipped bytes; otherwise stop at
+ * the first error.
+ */
+static IterV
+feed_codec(enum Codec_T ct, unsigned flags, void **z, struct Stream *str,
+	   const struct Repr_Format *repr, struct Input *in)
+{
+	for (;;) {
+		const size_t orig_size = str->size;
+		const IterV indic = run_codec(ct, flags, z, str, repr);
+		assert(indic == IE_DONE || indic == IE_CONT);
+		in->pos += orig_size - str->size;
+
+		if (flags & CF_KEEP_GOING && *z != NULL) {
+			const size_t n = skipped_codec(ct, *z);
+			if (n != 0)
+				error_at_line(0, 0, in->path, in->errpos,
+					      "%lu bytes skipped, resuming at"
+					      " offset %lu", (unsigned long) n,
+					      (unsigned long) (in->errpos + n));
+		}
+
+		if (indic == IE_DONE || str->errmsg == NULL)
+			return indic;
+
+		unsigned long line, col;
+		if (locate_codec(ct, *z, &line, &col) == 0)
+			error(0, 0, "%s:%lu:%lu: %s", in->path, line, col,
+			      str->errmsg);
+		else
+			error_at_line(0, 0, in->path, in->pos, "%s",
+				      str->errmsg);
+		++in->nerrors;
+
+		if (!(flags & CF_KEEP_GOING) || str->type == S_EOF ||
+		    recover_codec(ct, *z) != 0)
+			return IE_CONT;
+
+		in->errpos = in->pos;
+		free_errmsg(str->errmsg);
+		str->errmsg = NULL;
+	}
+}
+
 /*
  * This function is an /enumerator/ in the terminology of iteratees
  * [http://okmij.org/ftp/Streams.html].
  *
+ * @z: codec's state; it is reused for subsequent files
+ * @ld: contents of the file, if it has been prefetched (or NULL)
+ *
  * Return value: 0 - success, -1 - error.
  */
 static int
-process_file(enum Codec_T ct, const char *inpath, struct Buffer *inbuf,
-	     const struct Repr_Format *repr)
+process_file(enum Codec_T ct, unsigned flags, void **z, const char *inpath,
+	     struct Buffer *inbuf, const struct Repr_Format *repr,
+	     const struct Loaded *ld)
 {
 	debug_print("process_file: \"%s\"", inpath);
 	FILE *f = NULL;
+	struct Source src = { NULL, inbuf, NULL, NULL, 0, NULL, 0, NULL, NULL,
+			      0 };
 
-	if (streq(inpath, "-")) {
+	if (ld != NULL && ld->errnum != 0) {
+		error(0, ld->errnum, "%s", inpath);
+		return -1;
+	} else if (ld != NULL && ld->data != NULL) {
+		src.mem = ld->data;
+		src.memsize = ld->size;
+	} else if (streq(inpath, "-")) {
 		f = stdin;
 	} else if ((f = fopen(inpath, "rb")) == NULL) {
 		error(0, errno, "%s", inpath);
 		return -1;
 	}
 
-	if (adjust_buffer(inbuf, f) < 0) {
+	if (f != NULL && adjust_buffer(inbuf, f) < 0) {
 		error(0, errno, "%s", inpath);
 		return -1;
 	}
 
 	int retval = -1;
-	size_t filepos = 0;
+	struct Input in = { inpath, 0, 0, 0 };
 	struct Stream str = STREAM_INIT;
-	void *z = NULL;
+	src.f = f;
+	if (f != NULL && ct == ENCODER)
+		map_file(&src);
+	reset_codec(ct, *z);
 
-	for (;;) {
-		const size_t orig_size = read_block(inbuf->wptr, inbuf->size,
-						    f, &str);
-		str.type = ((str.size = orig_size) == 0) ? S_EOF : S_CHUNK;
-		str.data = inbuf->wptr;
+	size_t size = next_chunk(&src, &str);
+	const bool gzip_p = gzip_magic_p(str.data, size);
+	if (gzip_p) {
+		/*
+		 * Decompress in a separate thread, overlapping with codec.
+		 * Data in memory are inflated in place: they are released
+		 * after `pipeline_stop'.
+		 */
+		src.pipe = src.mem != NULL ?
+			gunzip_start(NULL, str.data, src.memsize + size,
+				     READAHEAD_BUFSIZE) :
+			gunzip_start(f, str.data, size, inbuf->size);
+		size = next_chunk(&src, &str);
+	} else if (src.mem == NULL && size != 0 && readahead_p(f)) {
+		src.pipe = readahead_start(f, str.data, size,
+					   READAHEAD_BUFSIZE, READAHEAD_NBUFS);
+		size = next_chunk(&src, &str);
+	}
+
+	/* Only input held in memory is encoded in parallel */
+	if (ct == ENCODER && encoder_jobs > 1 &&
+	    (src.pipe != NULL || src.mem == NULL))
+		error(0, 0, "%s: -j/--jobs has no effect: input is %s", inpath,
+		      gzip_p ? "compressed" : "not a regular file");
+
+	if (pem_magic_p(str.data, size)) {
+		/* Decode base64 as the data are consumed by codec */
+		src.pem = pem_new();
+		src.armored = str.data;
+		src.armsize = size;
+		size = next_chunk(&src, &str);
+	}
+
+	for (;; size = next_chunk(&src, &str)) {
+		str.type = ((str.size = size) == 0) ? S_EOF : S_CHUNK;
 
 		if (str.type == S_EOF && str.errmsg != NULL) {
-			error_at_line(0, 0, inpath, filepos, "%s", str.errmsg);
+			error_at_line(0, 0, inpath, in.pos, "%s", str.errmsg);
 			break;
 		}
 
-		const IterV indic = run_codec(ct, &z, &str, repr);
-		assert(indic == IE_DONE || indic == IE_CONT);
-		filepos += orig_size - str.size;
+		const IterV indic = feed_codec(ct, flags, z, &str, repr, &in);
 
-		if (indic == IE_CONT && str.errmsg != NULL) {
-			error_at_line(0, 0, inpath, filepos, "%s", str.errmsg);
+		if (indic == IE_CONT && str.errmsg != NULL)
 			break;
-		}
 
 		assert(str.size == 0);
 
 		if (indic == IE_DONE) {
-			retval = 0;
+			retval = in.nerrors == 0 ? 0 : -1;
 			break;
 		}
 	}
 
-	if (!streq(inpath, "-"))
+	pipeline_stop(src.pipe);
+	pem_free(src.pem);
+	if (src.map != NULL)
+		munmap(src.map, src.mapsize);
+	if (f != NULL && f != stdin)
 		retval |= fclose(f);
 
-	free(str.errmsg);
-	free_codec(ct, z); /* XXX malloc/free for each input file is not good */
+	free_errmsg(str.errmsg);
 	return retval;
 }
 
+/*
+ * Parse size specification -- a number, optionally followed by K, M
+ * or G suffix.
+ *
+ * Return -1 if the specification is invalid, otherwise return 0.
+ */
+static int
+parse_size(off_t *dest, const char *s)
+{
+	char *end;
+	errno = 0;
+	const unsigned long long n = strtoull(s, &end, 10);
+	unsigned shift = 0;
+
+	switch (*end) {
+	case 'K': shift = 10; ++end; break;
+	case 'M': shift = 20; ++end; break;
+	case 'G': shift = 30; ++end; break;
+	}
+
+	if (end == s || *end != '\0' || errno != 0 || n == 0 ||
+	    n > ((unsigned long long) INT64_MAX >> shift))
+		return -1;
+
+	*dest = n << shift;
+	return 0;
+}
+
 static void
 usage(char *argv0)
 {
@@ -166,45 +441,141 @@ usage(char *argv0)
 	printf("Usage: %s [OPTION] [FILE]...\n"
 	       "Decode DER from FILE(s), or standard input, to S-expressions.\n"
 	       "\n"
+	       "      --canonicalize  convert BER data to DER: definite"
+	       " lengths, primitive\n"
+	       "                 strings, sorted SET elements\n"
+	       "  -c, --check    validate DER data, producing no output\n"
 	       "  -e, --encode   encode S-expressions to DER data\n"
 	       "  -f, --format=FILE  interpret tags in accordance with"
 	       " the specification\n"
 	       "  -h, --help     display this help and exit\n"
+	       "      --hang     decode to indented lines without"
+	       " parentheses\n"
+	       "  -j, --jobs=N   with -e, encode large files in N threads\n"
+	       "  -k, --keep-going, --recover  skip broken records, resuming"
+	       " at the next\n"
+	       "                 top-level tag; report all errors rather"
+	       " than the first one\n"
+	       "      --line     decode each record to a single line\n"
+	       "      --oids[=FILE]  with --typed, print names of OBJECT"
+	       " IDENTIFIERs found in\n"
+	       "                 FILE (`1.2.3 name' per line) or in the"
+	       " compiled-in dictionary;\n"
+	       "                 -e accepts the names back\n"
+	       "      --pem[=LABEL]  with -e, write records as PEM blocks"
+	       " (`CERTIFICATE'\n"
+	       "                 is the default LABEL)\n"
+	       "  -o, --output=PREFIX  with --extract, write each encoding"
+	       " to a separate\n"
+	       "                 file PREFIX0001, PREFIX0002, etc.;"
+	       " see also --split\n"
+	       "  -s, --strict   with --check, reject BER encodings that"
+	       " are not valid DER\n"
+	       "      --typed    decode INTEGER, OBJECT IDENTIFIER, strings,"
+	       " etc. to readable\n"
+	       "                 values in square brackets; -e accepts"
+	       " them back\n"
 	       "  -V, --version  output version information and exit\n"
+	       "  -x, --extract=SPEC  copy raw DER encodings selected by"
+	       " SPEC to the output\n"
+	       "\n"
+	       "SPEC is a comma-separated list of record numbers (counting"
+	       " from 1 in each\n"
+	       "FILE), ranges of them (`N-M', `N-') and tag paths (`p1',"
+	       " `p1/p14').\n"
+	       "\n"
+	       "      --cat      concatenate top-level records of FILE(s)"
+	       " to standard output,\n"
+	       "                 dropping filler bytes\n"
+	       "      --pad=SIZE  with --cat, pack records into blocks of"
+	       " SIZE bytes, padding\n"
+	       "                 them with fillers\n"
+	       "      --split=N  split each FILE into N shards of nearly"
+	       " equal size\n"
+	       "      --split-size=SIZE  split each FILE into shards of"
+	       " at most SIZE bytes\n"
+	       "                 (K, M, G suffixes are allowed)\n"
+	       "\n"
+	       "Shards are written to files PREFIX0001, PREFIX0002, etc."
+	       " (`x' is the default\n"
+	       "PREFIX).  With --extract, --split and --cat, FILE(s)"
+	       " should be regular ones.\n"
 	       "\n"
 	       "With no FILE, or when FILE is -, read standard input.\n"
+	       "gzip-compressed input is decompressed on the fly; PEM"
+	       " input (`-----BEGIN')\n"
+	       "is decoded to DER the same way.\n"
 	       "\n"
 	       "Examples:\n"
 	       "  %s f - g  Decode f's contents, then standard input,"
 	       " then g's contents.\n"
 	       "  %s -e     Encode standard input to standard output.\n"
+	       "  %s -x 1,5- f  Copy records of f, except for 2-4,"
+	       " to standard output.\n"
 	       "\n"
 	       "Report bugs to valery.vv@gmail.com\n"
-	       "Home page: <http://github.com/vvv/under.c>\n", s, s, s);
+	       "Home page: <http://github.com/vvv/under.c>\n", s, s, s, s);
 }
 
 int
 main(int argc, char **argv)
 {
 	enum Codec_T ct = DECODER;
+	unsigned flags = 0;
 	REPR_FORMAT(repr);
 	BUFFER(inbuf);
+	void *z = NULL; /* codec's state */
+	struct Extract extract = { NULL, 0, NULL, 0 };
+	bool extract_p = false;
+	struct Split split = { 0, 0 };
+	const char *outprefix = NULL;
+
+	bool cat_p = false;
+	bool oids_p = false;
+	off_t blksize = 0;
+
+	enum { OPT_SPLIT = 0x100, OPT_SPLIT_SIZE, OPT_CAT, OPT_PAD, OPT_LINE,
+	       OPT_HANG, OPT_TYPED, OPT_OIDS, OPT_PEM,
+	       OPT_CANONICALIZE };
 
 	const struct option longopts[] = {
+		{ "check", 0, NULL, 'c' },
 		{ "encode", 0, NULL, 'e' },
 		{ "format", 1, NULL, 'f' },
 		{ "help", 0, NULL, 'h' },
-		{ "version", 0, NULL, 'V' }
+		{ "jobs", 1, NULL, 'j' },
+		{ "keep-going", 0, NULL, 'k' },
+		{ "output", 1, NULL, 'o' },
+		{ "recover", 0, NULL, 'k' },
+		{ "strict", 0, NULL, 's' },
+		{ "version", 0, NULL, 'V' },
+		{ "extract", 1, NULL, 'x' },
+		{ "split", 1, NULL, OPT_SPLIT },
+		{ "split-size", 1, NULL, OPT_SPLIT_SIZE },
+		{ "cat", 0, NULL, OPT_CAT },
+		{ "pad", 1, NULL, OPT_PAD },
+		{ "line", 0, NULL, OPT_LINE },
+		{ "hang", 0, NULL, OPT_HANG },
+		{ "typed", 0, NULL, OPT_TYPED },
+		{ "oids", 2, NULL, OPT_OIDS },
+		{ "pem", 2, NULL, OPT_PEM },
+		{ "canonicalize", 0, NULL, OPT_CANONICALIZE },
+		{ NULL, 0, NULL, 0 }
 	};
 	int c;
-	while ((c = getopt_long(argc, argv, "ef:hV", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "cef:hj:ko:sVx:", longopts, NULL))
+	       != -1) {
 		switch (c) {
+		case 'c':
+			ct = CHECKER;
+			break;
+
 		case 'e':
 			ct = ENCODER;
 			break;
 
 		case 'f':
-			if (repr.dict != NULL) {
+			if (repr.dict != NULL || repr.top != NULL) {
 				repr_destroy(&repr);
 				die("Multiple -f/--format options are not"
 				    " allowed");
@@ -220,6 +591,100 @@ main(int argc, char **argv)
 			usage(*argv);
 			return 0;
 
+		case 'j': {
+			char *end;
+			errno = 0;
+			const unsigned long n = strtoul(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || errno != 0 ||
+			    n == 0 || n > 1024)
+				die("Invalid number of jobs: `%s'", optarg);
+
+			encoder_jobs = n;
+			break;
+		}
+
+		case 'k':
+			flags |= CF_KEEP_GOING;
+			break;
+
+		case 'o':
+			outprefix = optarg;
+			break;
+
+		case 's':
+			flags |= CF_STRICT;
+			break;
+
+		case 'x':
+			if (extract_p) {
+				extract_destroy(&extract);
+				die("Multiple -x/--extract options are not"
+				    " allowed");
+			}
+
+			if (extract_create(&extract, optarg) != 0) {
+				extract_destroy(&extract);
+				return 1;
+			}
+			extract_p = true;
+			break;
+
+		case OPT_SPLIT: {
+			off_t n;
+			if (parse_size(&n, optarg) != 0 || n > 1000000)
+				die("Invalid number of shards: `%s'", optarg);
+
+			split.nshards = n;
+			split.maxsize = 0;
+			break;
+		}
+
+		case OPT_SPLIT_SIZE:
+			split.nshards = 0;
+			if (parse_size(&split.maxsize, optarg) != 0)
+				die("Invalid shard size: `%s'", optarg);
+			break;
+
+		case OPT_CAT:
+			cat_p = true;
+			break;
+
+		case OPT_PAD:
+			if (parse_size(&blksize, optarg) != 0)
+				die("Invalid block size: `%s'", optarg);
+			break;
+
+		case OPT_LINE:
+			flags = (flags & ~CF_HANG) | CF_LINE;
+			break;
+
+		case OPT_HANG:
+			flags = (flags & ~CF_LINE) | CF_HANG;
+			break;
+
+		case OPT_TYPED:
+			flags |= CF_TYPED;
+			break;
+
+		case OPT_OIDS:
+			if (oids_p)
+				die("Multiple --oids options are not allowed");
+			if (oid_dict_load(optarg) != 0)
+				return 1;
+			oids_p = true;
+			flags |= CF_TYPED;
+			break;
+
+		case OPT_CANONICALIZE:
+			ct = CANONICALIZER;
+			break;
+
+		case OPT_PEM:
+			if (optarg != NULL)
+				pem_label = optarg;
+			flags |= CF_PEM;
+			break;
+
 		case 'V':
 			printf("%s %s\n", basename(*argv), VERSION);
 			return 0;
@@ -229,16 +694,69 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (flags & CF_STRICT && ct != CHECKER)
+		die("-s/--strict can only be used with -c/--check");
+	if (encoder_jobs > 1 && ct != ENCODER)
+		die("-j/--jobs can only be used with -e/--encode");
+	if (encoder_jobs > 1 && flags & CF_PEM)
+		die("-j/--jobs cannot be used with --pem");
+
 	int rv = 0;
-	if (optind == argc) {
-		rv = process_file(ct, "-", &inbuf, &repr);
-	} else {
+	if (extract_p) {
+		struct Output out = OUTPUT_INIT(outprefix);
+
+		if (optind == argc)
+			rv = extract_file(&extract, "-", &out);
+
 		int i;
 		for (i = optind; i < argc; ++i)
-			rv |= process_file(ct, argv[i], &inbuf, &repr);
+			rv |= extract_file(&extract, argv[i], &out);
+
+		rv |= output_close(&out);
+		extract_destroy(&extract);
+	} else if (cat_p) {
+		struct Cat cat = CAT_INIT(STDOUT_FILENO, blksize);
+
+		if (optind == argc)
+			rv = cat_file(&cat, "-");
+
+		int i;
+		for (i = optind; i < argc; ++i)
+			rv |= cat_file(&cat, argv[i]);
+
+		rv |= cat_finish(&cat);
+	} else if (split.nshards != 0 || split.maxsize != 0) {
+		struct Output out = OUTPUT_INIT(outprefix == NULL ? "x" :
+						outprefix);
+		if (optind == argc)
+			rv = split_file(&split, "-", &out);
+
+		int i;
+		for (i = optind; i < argc; ++i)
+			rv |= split_file(&split, argv[i], &out);
+	} else if (optind == argc) {
+		rv = process_file(ct, flags, &z, "-", &inbuf, &repr, NULL);
+	} else {
+		/* Read small files ahead, while preceding ones are decoded */
+		struct Pipeline *pf = argc - optind > 1 ?
+			prefetch_start(argv + optind, argc - optind) : NULL;
+		struct Loaded ld;
+
+		int i;
+		for (i = optind; i < argc; ++i) {
+			const bool ld_p = pf != NULL && prefetch_next(pf, &ld)
+				== 0;
+			rv |= process_file(ct, flags, &z, argv[i], &inbuf,
+					   &repr, ld_p ? &ld : NULL);
+			if (ld_p)
+				free(ld.data);
+		}
+		pipeline_stop(pf);
 	}
 
+	free_codec(ct, z);
 	repr_destroy(&repr);
+	oid_dict_destroy();
 	free(buffer_data(&inbuf));
 	return -rv;
 }
@@ -0,0 +1,634 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <stdio.h>
+#include <inttypes.h>
+#include <ctype.h>
+
+#include "universal.h"
+#include "oid.h"
+#include "buffer.h"
+#include "util.h"
+
+/* Write error message to `dest' and return -1 */
+static int
+fail(struct Buffer *dest, const char *msg)
+{
+	buffer_reset(dest);
+	buffer_reserve(dest, 128);
+	buffer_printf(dest, "%s", msg);
+	return -1;
+}
+
+/* Make room for `n' bytes of output */
+static inline int
+reserve(struct Buffer *dest, size_t n)
+{
+	return buffer_reserve(dest, n) == 0 ? 0 :
+		fail(dest, "Out of memory, buffer_reserve failed");
+}
+
+/*
+ * Account for the bytes written to `dest->wptr' directly; terminate
+ * them with '\0' (there's a reserved byte in a buffer).
+ */
+static inline int
+commit(struct Buffer *dest, uint8_t *end)
+{
+	*end = 0;
+	dest->size -= end - dest->wptr;
+	dest->wptr = end;
+	return 0;
+}
+
+/* Write decimal representation of `v'; return the end of output */
+static inline uint8_t *
+put_u64(uint8_t *p, uint64_t v)
+{
+	uint8_t tmp[20];
+	uint8_t *t = tmp + sizeof(tmp);
+
+	do {
+		*--t = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+
+	const size_t n = tmp + sizeof(tmp) - t;
+	memcpy(p, t, n);
+	return p + n;
+}
+
+/*
+ * Drop redundant leading octets of two's complement integer
+ * [ITU-T X.690, 8.3.2].
+ */
+static const uint8_t *
+minimal_integer(const uint8_t *p, size_t *n)
+{
+	while (*n > 1 && ((p[0] == 0 && !(p[1] & 0x80)) ||
+			  (p[0] == 0xff && (p[1] & 0x80)))) {
+		++p;
+		--*n;
+	}
+
+	return p;
+}
+
+/*
+ * BOOLEAN
+ */
+
+static int
+decode_boolean(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (n != 1 || (*src != 0 && *src != 0xff))
+		return fail(dest, "BOOLEAN: 00 or ff octet expected");
+
+	return buffer_printf(dest, "%s", *src == 0 ? "FALSE" : "TRUE");
+}
+
+static int
+encode_boolean(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (n == 4 && memcmp(src, "TRUE", 4) == 0)
+		return reserve(dest, 1) ?: buffer_putc(dest, 0xff);
+	else if (n == 5 && memcmp(src, "FALSE", 5) == 0)
+		return reserve(dest, 1) ?: buffer_putc(dest, 0);
+	else
+		return fail(dest, "BOOLEAN: TRUE or FALSE expected");
+}
+
+/*
+ * INTEGER, ENUMERATED
+ */
+
+/* Decimal representation of integer that does not fit into 64 bits */
+static int
+decode_bignum(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	const bool neg_p = *src & 0x80;
+
+	/* Magnitude, as 32-bit limbs; the most significant one first */
+	const size_t nlimbs = (n + 3) / 4;
+	uint32_t *limbs = xmalloc(nlimbs * sizeof(uint32_t));
+	memset(limbs, 0, nlimbs * sizeof(uint32_t));
+
+	size_t i;
+	for (i = 0; i < n; ++i) {
+		const size_t k = n - 1 - i; /* position of the octet */
+		limbs[nlimbs - 1 - k/4] |= (uint32_t) (neg_p ? ~src[i] & 0xff
+						       : src[i]) << 8*(k % 4);
+	}
+
+	if (neg_p) /* two's complement: magnitude = ~x + 1 */
+		for (i = nlimbs; i-- != 0 && ++limbs[i] == 0; )
+			;
+
+	/* Groups of 9 decimal digits; the least significant one first */
+	uint32_t *groups = xmalloc((n / 3 + 2) * sizeof(uint32_t));
+	size_t ngroups = 0;
+	size_t start = 0; /* the first non-zero limb */
+
+	while (start < nlimbs) {
+		uint64_t rem = 0;
+
+		for (i = start; i < nlimbs; ++i) {
+			const uint64_t cur = rem << 32 | limbs[i];
+			limbs[i] = cur / 1000000000;
+			rem = cur % 1000000000;
+		}
+		groups[ngroups++] = rem;
+
+		while (start < nlimbs && limbs[start] == 0)
+			++start;
+	}
+
+	int rv = buffer_printf(dest, "%s%" PRIu32, neg_p ? "-" : "",
+			       groups[--ngroups]);
+	while (rv == 0 && ngroups != 0)
+		rv = buffer_printf(dest, "%09" PRIu32, groups[--ngroups]);
+
+	free(groups);
+	free(limbs);
+	return rv == 0 ? 0 : fail(dest, "INTEGER: too many digits");
+}
+
+static int
+decode_integer(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (n == 0)
+		return fail(dest, "INTEGER: no contents octets");
+
+	size_t m = n;
+	minimal_integer(src, &m);
+	if (m != n)
+		return fail(dest, "INTEGER: redundant leading octets");
+
+	if (n > 8) {
+		if (reserve(dest, 3 * n + 2) != 0)
+			return -1;
+		return decode_bignum(dest, src, n);
+	}
+
+	uint64_t v = *src & 0x80 ? ~UINT64_C(0) : 0;
+	for (; n != 0; ++src, --n)
+		v = v << 8 | *src;
+
+	return buffer_printf(dest, "%" PRId64, (int64_t) v);
+}
+
+static int
+encode_integer(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	const bool neg_p = n != 0 && *src == '-';
+	if (neg_p) {
+		++src;
+		--n;
+	}
+
+	size_t i;
+	for (i = 0; i < n && src[i] >= '0' && src[i] <= '9'; ++i)
+		;
+	if (n == 0 || i != n)
+		return fail(dest, "INTEGER: decimal number expected");
+
+	/* Two's complement, the most significant octet first */
+	const size_t size = n <= 18 ? 8 : n/2 + 2;
+	uint8_t small[8];
+	uint8_t *x = size > sizeof(small) ? xmalloc(size) : small;
+
+	if (n <= 18) {
+		int64_t v = 0;
+		for (i = 0; i < n; ++i)
+			v = 10*v + (src[i] - '0');
+		if (neg_p)
+			v = -v;
+
+		for (i = size; i-- != 0; v >>= 8)
+			x[i] = v & 0xff;
+	} else {
+		memset(x, 0, size);
+
+		for (; n != 0; ++src, --n) {
+			unsigned carry = *src - '0';
+			for (i = size; i-- != 0; carry >>= 8) {
+				carry += 10 * x[i];
+				x[i] = carry & 0xff;
+			}
+		}
+
+		if (neg_p) {
+			for (i = 0; i < size; ++i)
+				x[i] = ~x[i];
+			for (i = size; i-- != 0 && ++x[i] == 0; )
+				;
+		}
+	}
+
+	size_t len = size;
+	const uint8_t *p = minimal_integer(x, &len);
+
+	const int rv = reserve(dest, len) ?: buffer_put(dest, p, len);
+	if (x != small)
+		free(x);
+	return rv;
+}
+
+/*
+ * OBJECT IDENTIFIER, RELATIVE-OID
+ */
+
+static int
+decode_arcs(struct Buffer *dest, const uint8_t *src, size_t n,
+	    bool relative_p)
+{
+	if (n == 0)
+		return fail(dest, "OBJECT IDENTIFIER: no contents octets");
+	if (src[n - 1] & 0x80)
+		return fail(dest, "OBJECT IDENTIFIER: truncated"
+			    " subidentifier");
+
+	/* Every octet yields at most 3 digits and a dot */
+	if (reserve(dest, 4*n + 3) != 0)
+		return -1;
+
+	uint8_t *p = dest->wptr;
+	const uint8_t * const end = src + n;
+	bool first_p = !relative_p;
+	uint64_t v = 0;
+
+	for (; src != end; ++src) {
+		if (v == 0 && *src == 0x80)
+			return fail(dest, "OBJECT IDENTIFIER: subidentifier"
+				    " has redundant leading octets");
+		if (v >> 57)
+			return fail(dest, "OBJECT IDENTIFIER: subidentifier"
+				    " is too big");
+
+		v = v << 7 | (*src & 0x7f);
+		if (*src & 0x80)
+			continue;
+
+		if (first_p) { /* the first two arcs [ITU-T X.690, 8.19.4] */
+			const unsigned x = v < 40 ? 0 : v < 80 ? 1 : 2;
+			*p++ = '0' + x;
+			*p++ = '.';
+			v -= 40 * x;
+			first_p = false;
+		}
+
+		p = put_u64(p, v);
+		*p++ = '.';
+		v = 0;
+	}
+
+	return commit(dest, p - 1); /* drop the trailing dot */
+}
+
+static int
+decode_oid(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	const char *name = oid_name(src, n);
+
+	return name == NULL ? decode_arcs(dest, src, n, false) :
+		buffer_printf(dest, "%s", name);
+}
+
+static int
+decode_relative_oid(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	return decode_arcs(dest, src, n, true);
+}
+
+/* Append base-128 encoding of subidentifier */
+static inline uint8_t *
+put_subid(uint8_t *p, uint64_t v)
+{
+	uint8_t tmp[10];
+	uint8_t *t = tmp + sizeof(tmp);
+
+	*--t = v & 0x7f;
+	while ((v >>= 7) != 0)
+		*--t = 0x80 | (v & 0x7f);
+
+	const size_t n = tmp + sizeof(tmp) - t;
+	memcpy(p, t, n);
+	return p + n;
+}
+
+static int
+encode_arcs(struct Buffer *dest, const uint8_t *src, size_t n,
+	    bool relative_p)
+{
+	/* A subidentifier takes no more octets than its digits */
+	if (reserve(dest, n + 1) != 0)
+		return -1;
+
+	uint8_t *p = dest->wptr;
+	const uint8_t * const end = src + n;
+	unsigned narcs = 0;
+	uint64_t first = 0;
+
+	for (;;) {
+		const uint8_t *s = src;
+		uint64_t v = 0;
+
+		for (; src != end && *src >= '0' && *src <= '9'; ++src) {
+			const unsigned d = *src - '0';
+			if (v > UINT64_MAX / 10 || 10*v > UINT64_MAX - d)
+				return fail(dest, "OBJECT IDENTIFIER: arc is"
+					    " too big");
+			v = 10*v + d;
+		}
+		if (src == s)
+			return fail(dest, "OBJECT IDENTIFIER: digit"
+				    " expected");
+
+		if (relative_p || narcs > 1) {
+			p = put_subid(p, v);
+		} else if (narcs == 0) {
+			if (v > 2)
+				return fail(dest, "OBJECT IDENTIFIER: the"
+					    " first arc must be 0, 1 or 2");
+			first = v;
+		} else {
+			if (first < 2 && v >= 40)
+				return fail(dest, "OBJECT IDENTIFIER: the"
+					    " second arc must be less than 40");
+			if (v > UINT64_MAX - 80)
+				return fail(dest, "OBJECT IDENTIFIER: arc is"
+					    " too big");
+			p = put_subid(p, 40*first + v);
+		}
+		++narcs;
+
+		if (src == end)
+			break;
+		if (*src++ != '.')
+			return fail(dest, "OBJECT IDENTIFIER: `.' expected");
+	}
+
+	if (narcs < 2 && !relative_p)
+		return fail(dest, "OBJECT IDENTIFIER: at least two arcs"
+			    " expected");
+
+	return commit(dest, p);
+}
+
+static int
+encode_oid(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (n == 0 || !isalpha(*src))
+		return encode_arcs(dest, src, n, false);
+
+	const uint8_t *enc;
+	size_t size;
+	if (oid_by_name((const char *) src, n, &enc, &size) != 0)
+		return fail(dest, "OBJECT IDENTIFIER: unknown name");
+
+	return reserve(dest, size) ?: buffer_put(dest, enc, size);
+}
+
+static int
+encode_relative_oid(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	return encode_arcs(dest, src, n, true);
+}
+
+/*
+ * BIT STRING
+ */
+
+static const char xdigits[] = "0123456789ABCDEF";
+
+static int
+decode_bit_string(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (n == 0 || *src > 7 || (n == 1 && *src != 0))
+		return fail(dest, "BIT STRING: invalid number of unused"
+			    " bits");
+
+	const unsigned unused = *src++;
+	--n;
+
+	if (unused != 0 && (src[n - 1] & ((1U << unused) - 1)) != 0)
+		return fail(dest, "BIT STRING: unused bits are not zero");
+
+	const size_t nbits = 8*n - unused;
+	if (nbits > 64 && unused != 0)
+		return fail(dest, "BIT STRING: too long for `B' notation");
+
+	if (reserve(dest, 2*n + 3 + (nbits <= 64 ? nbits : 0)) != 0)
+		return -1;
+
+	uint8_t *p = dest->wptr;
+	*p++ = '\'';
+
+	size_t i;
+	if (nbits <= 64) {
+		for (i = 0; i < nbits; ++i)
+			*p++ = '0' + (src[i / 8] >> (7 - i % 8) & 1);
+		*p++ = '\'';
+		*p++ = 'B';
+	} else {
+		for (i = 0; i < n; ++i) {
+			*p++ = xdigits[src[i] >> 4];
+			*p++ = xdigits[src[i] & 0xf];
+		}
+		*p++ = '\'';
+		*p++ = 'H';
+	}
+
+	return commit(dest, p);
+}
+
+static int
+encode_bit_string(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (n < 3 || src[0] != '\'' || src[n - 2] != '\'' ||
+	    (src[n - 1] != 'B' && src[n - 1] != 'H'))
+		return fail(dest, "BIT STRING: '...'B or '...'H expected");
+
+	const bool hex_p = src[n - 1] == 'H';
+	const uint8_t * const end = src + n - 2;
+	const unsigned digit_bits = hex_p ? 4 : 1;
+
+	if (reserve(dest, n) != 0)
+		return -1;
+
+	uint8_t *p = dest->wptr;
+	uint8_t *unused = p++;
+	size_t nbits = 0;
+
+	for (++src; src != end; ++src) {
+		unsigned d;
+
+		if (*src >= '0' && *src <= (hex_p ? '9' : '1'))
+			d = *src - '0';
+		else if (hex_p && *src >= 'A' && *src <= 'F')
+			d = *src - 'A' + 10;
+		else if (hex_p && *src >= 'a' && *src <= 'f')
+			d = *src - 'a' + 10;
+		else
+			return fail(dest, hex_p ? "BIT STRING: hexadecimal"
+				    " digit expected" :
+				    "BIT STRING: binary digit expected");
+
+		if (nbits % 8 == 0)
+			*p++ = 0;
+		p[-1] |= d << (8 - digit_bits - nbits % 8);
+		nbits += digit_bits;
+	}
+
+	*unused = (8 - nbits % 8) % 8;
+	return commit(dest, p);
+}
+
+/*
+ * Character strings, UTCTime, GeneralizedTime
+ */
+
+/* Append a character, escaping it unless `plain_p' is true */
+static inline uint8_t *
+put_char(uint8_t *p, uint8_t c, bool plain_p)
+{
+	if (plain_p && c != '\\' && c != ']') {
+		*p++ = c;
+	} else if (plain_p) {
+		*p++ = '\\';
+		*p++ = c;
+	} else {
+		*p++ = '\\';
+		*p++ = 'x';
+		*p++ = "0123456789abcdef"[c >> 4];
+		*p++ = "0123456789abcdef"[c & 0xf];
+	}
+	return p;
+}
+
+static inline bool
+printable_p(uint8_t c)
+{
+	return c >= 0x20 && c < 0x7f;
+}
+
+static int
+decode_ascii(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (reserve(dest, 4*n + 1) != 0)
+		return -1;
+
+	uint8_t *p = dest->wptr;
+	for (; n != 0; ++src, --n)
+		p = put_char(p, *src, printable_p(*src));
+
+	return commit(dest, p);
+}
+
+/*
+ * Return the length of well-formed UTF-8 sequence at `src'
+ * [RFC 3629, 4]; return 0 if the sequence is ill-formed.
+ */
+static size_t
+utf8_seqlen(const uint8_t *src, size_t n)
+{
+	uint8_t lo = 0x80, hi = 0xbf; /* range of the second octet */
+	size_t len;
+
+	if (*src < 0xc2) {
+		return 0;
+	} else if (*src < 0xe0) {
+		len = 2;
+	} else if (*src < 0xf0) {
+		len = 3;
+		if (*src == 0xe0)
+			lo = 0xa0;
+		else if (*src == 0xed) /* surrogates */
+			hi = 0x9f;
+	} else if (*src < 0xf5) {
+		len = 4;
+		if (*src == 0xf0)
+			lo = 0x90;
+		else if (*src == 0xf4)
+			hi = 0x8f;
+	} else {
+		return 0;
+	}
+
+	if (n < len || src[1] < lo || src[1] > hi)
+		return 0;
+
+	size_t i;
+	for (i = 2; i < len; ++i)
+		if ((src[i] & 0xc0) != 0x80)
+			return 0;
+
+	return len;
+}
+
+static int
+decode_utf8(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	if (reserve(dest, 4*n + 1) != 0)
+		return -1;
+
+	uint8_t *p = dest->wptr;
+	const uint8_t * const end = src + n;
+
+	while (src != end) {
+		size_t len;
+
+		if (*src < 0x80 || (len = utf8_seqlen(src, end - src)) == 0) {
+			p = put_char(p, *src, printable_p(*src));
+			++src;
+		} else {
+			memcpy(p, src, len);
+			p += len;
+			src += len;
+		}
+	}
+
+	return commit(dest, p);
+}
+
+/* Escape sequences are resolved by the encoder already */
+static int
+encode_string(struct Buffer *dest, const uint8_t *src, size_t n)
+{
+	return reserve(dest, n) ?: buffer_put(dest, src, n);
+}
+
+static const struct {
+	Repr_Codec decode;
+	Repr_Codec encode;
+} codecs[] = {
+	[UT_BOOLEAN] = { decode_boolean, encode_boolean },
+	[UT_INTEGER] = { decode_integer, encode_integer },
+	[UT_BIT_STRING] = { decode_bit_string, encode_bit_string },
+	[UT_OBJECT_IDENTIFIER] = { decode_oid, encode_oid },
+	[UT_ENUMERATED] = { decode_integer, encode_integer },
+	[UT_UTF8_STRING] = { decode_utf8, encode_string },
+	[UT_RELATIVE_OID] = { decode_relative_oid, encode_relative_oid },
+	[UT_NUMERIC_STRING] = { decode_ascii, encode_string },
+	[UT_PRINTABLE_STRING] = { decode_ascii, encode_string },
+	[UT_IA5_STRING] = { decode_ascii, encode_string },
+	[UT_UTC_TIME] = { decode_ascii, encode_string },
+	[UT_GENERALIZED_TIME] = { decode_ascii, encode_string },
+	[UT_VISIBLE_STRING] = { decode_ascii, encode_string }
+};
+
+Repr_Codec
+universal_decoder(uint32_t num)
+{
+	return num < ARRAY_SIZE(codecs) ? codecs[num].decode : NULL;
+}
+
+Repr_Codec
+universal_encoder(uint32_t num)
+{
+	return num < ARRAY_SIZE(codecs) ? codecs[num].encode : NULL;
+}
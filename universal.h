@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2010  Valery V. Vorotyntsev <valery.vv@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _UNIVERSAL_H
+#define _UNIVERSAL_H
+
+#include "repr.h"
+
+/*
+ * Typed representations of primitive contents of universal tags:
+ *
+ *   BOOLEAN                   TRUE, FALSE
+ *   INTEGER, ENUMERATED       -12345678901234567890
+ *   OBJECT IDENTIFIER         1.2.840.113549.1.1.11, or the name
+ *                             from OID dictionary (see oid.h)
+ *   RELATIVE-OID              8571.3.2
+ *   BIT STRING                '0110'B (up to 64 bits), 'A1B2...'H
+ *   UTF8String, PrintableString, IA5String, NumericString,
+ *   VisibleString, UTCTime, GeneralizedTime
+ *                             text, with `\', `]' and non-printable
+ *                             bytes escaped as `\\', `\]' and `\xHH'
+ *
+ * The decoder encloses representations in square brackets.  The
+ * encoder resolves escape sequences before passing the text to
+ * `universal_encoder'.
+ *
+ * Decoders fail on encodings that would not be reproduced by the
+ * encoder (e.g., INTEGER with redundant leading octets), so that
+ * decoded data can be encoded back to identical bytes.
+ */
+
+/* Return the decoder of universal tag `num'; NULL if there is none */
+Repr_Codec universal_decoder(uint32_t num);
+
+/* Return the encoder of universal tag `num'; NULL if there is none */
+Repr_Codec universal_encoder(uint32_t num);
+
+#endif /* _UNIVERSAL_H */
@@ -6,7 +6,7 @@
  * published by the Free Software Foundation.
  */
 #include <stdio.h>
-#include <stdarg.h>
+#include <stddef.h>
 #include <assert.h>
 
 #include "util.h"
@@ -32,13 +32,41 @@ debug_hexdump(const char *msg, const void *addr, size_t size)
 }
 #endif
 
+size_t
+filler_span(const void *src, size_t n)
+{
+	const uint8_t *p = src;
+	const uint8_t * const end = p + n;
+	uint64_t w[4];
+
+	/* Compare 32 bytes at once, ... */
+	for (; end - p >= (ptrdiff_t) sizeof(w); p += sizeof(w)) {
+		memcpy(w, p, sizeof(w));
+		if ((w[0] & w[1] & w[2] & w[3]) != UINT64_MAX)
+			break;
+	}
+
+	/* ... then 8 bytes, ... */
+	for (; end - p >= (ptrdiff_t) sizeof(*w); p += sizeof(*w)) {
+		memcpy(w, p, sizeof(*w));
+		if (*w != UINT64_MAX)
+			break;
+	}
+
+	/* ... then locate the first non-filler byte */
+	while (p != end && *p == 0xff)
+		++p;
+
+	return p - (const uint8_t *) src;
+}
+
 void
-xasprintf(char **strp, const char *format, ...)
+vxasprintf(char **strp, const char *format, va_list ap)
 {
 	assert(*strp == NULL);
 
-	va_list ap;
-	va_start(ap, format);
+	va_list aq;
+	va_copy(aq, ap);
 
 	*strp = xmalloc(80);
 	const size_t nchars = vsnprintf(*strp, 80, format, ap);
@@ -47,8 +75,17 @@ xasprintf(char **strp, const char *format, ...)
 		*strp = xrealloc(*strp, nchars + 1);
 
 		 /* .. and try again. */
-		vsnprintf(*strp, nchars + 1, format, ap);
+		vsnprintf(*strp, nchars + 1, format, aq);
 	}
 
+	va_end(aq);
+}
+
+void
+xasprintf(char **strp, const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	vxasprintf(strp, format, ap);
 	va_end(ap);
 }
@@ -9,6 +9,7 @@
 #define _UTIL_H
 
 #include <error.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -74,7 +75,17 @@ streq(const char *s1, const char *s2)
 	return strcmp(s1, s2) == 0;
 }
 
+/*
+ * Return the number of leading 0xff bytes (fillers) in a memory region.
+ *
+ * The region is scanned a few words at a time.
+ */
+size_t filler_span(const void *src, size_t n);
+
 /* Print to allocated string, die()ing on error */
 void xasprintf(char **strp, const char *format, ...);
 
+/* Equivalent to `xasprintf', except that it is called with a va_list */
+void vxasprintf(char **strp, const char *format, va_list ap);
+
 #endif /* _UTIL_H */